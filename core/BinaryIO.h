@@ -0,0 +1,40 @@
+#ifndef ___BINARYIO_H9
+#define ___BINARYIO_H9
+#include "global.h"
+#include<cstring>
+
+/* Little endian records, as written in recovery journals and session files
+Integers are 32 or 64-bit; strings are prefixed by their length in characters
+Get functions advance p and return false if the data ends before the value
+*/
+
+inline void PutInt (string& s, int n) { s.append((const char*)&n, 4); }
+inline void PutInt64 (string& s, unsigned long long n) { s.append((const char*)&n, 8); }
+inline void PutString (string& s, const tstring& str) {
+PutInt(s, str.size());
+s.append((const char*)str.data(), str.size()*sizeof(TCHAR));
+}
+
+inline bool GetInt (const char*& p, const char* end, int& n) {
+if (p+4>end) return false;
+memcpy(&n, p, 4);
+p+=4;
+return true;
+}
+
+inline bool GetInt64 (const char*& p, const char* end, unsigned long long& n) {
+if (p+8>end) return false;
+memcpy(&n, p, 8);
+p+=8;
+return true;
+}
+
+inline bool GetString (const char*& p, const char* end, tstring& str) {
+int len;
+if (!GetInt(p, end, len) || len<0 || len>(end-p)/sizeof(TCHAR)) return false;
+str.assign((const TCHAR*)p, len);
+p += len*sizeof(TCHAR);
+return true;
+}
+
+#endif
@@ -0,0 +1,231 @@
+#include "BracketIndex.h"
+#include "page.h"
+#include "inifile.h"
+#include "sixpad.h"
+#include<algorithm>
+#include<unordered_map>
+using namespace std;
+
+#if defined(__GNUC__) && (defined(__i386__) || defined(__x86_64__))
+#include<emmintrin.h>
+#define BRACKET_INDEX_SSE2
+#endif
+
+#define MAX_STOP_CHARS 16
+
+struct LexerProfile {
+tstring lineComment, blockCommentStart, blockCommentEnd, quotes;
+bool operator== (const LexerProfile& l) const { return lineComment==l.lineComment && blockCommentStart==l.blockCommentStart && blockCommentEnd==l.blockCommentEnd && quotes==l.quotes; }
+bool operator!= (const LexerProfile& l) const { return !(*this==l); }
+};
+
+struct BracketIndex {
+unsigned int generation = 0; // Edit generation of the page the index corresponds to
+int dirtyFrom = -1; // First position modified since the index was built, -1 if it is up to date
+bool built = false;
+LexerProfile profile;
+vector<int> positions; // Brackets outside strings and comments
+vector<char> kinds;
+vector<int> matches, parents; // Index of the matching bracket and of the innermost opening bracket enclosing each bracket, -1 if there is none
+vector<int> skipStarts, skipEnds; // Strings and comments
+};
+
+static unordered_map<Page*, BracketIndex> bracketIndexes; // Only accessed from the UI thread
+
+static inline bool IsOpeningBracket (char c) { return c=='(' || c=='[' || c=='{'; }
+static inline char OpeningBracketOf (char c) { return c==')'? '(' : c==']'? '[' : c=='}'? '{' : 0; }
+static inline bool IsBracket (TCHAR c) { return c=='(' || c==')' || c=='[' || c==']' || c=='{' || c=='}'; }
+
+static LexerProfile GetLexerProfile (Page& p) {
+LexerProfile lp;
+int slash = p.file.find_last_of(TEXT("\\/")), dot = p.file.rfind('.');
+if (dot<0 || dot<slash) return lp;
+string section = "lexer." + toString(to_lower_copy(p.file.substr(dot+1)));
+lp.lineComment = sp->config->get(section, "lineComment", tstring());
+lp.blockCommentStart = sp->config->get(section, "blockCommentStart", tstring());
+lp.blockCommentEnd = sp->config->get(section, "blockCommentEnd", tstring());
+lp.quotes = sp->config->get(section, "quotes", tstring());
+if (lp.blockCommentEnd.empty()) lp.blockCommentStart.clear();
+return lp;
+}
+
+static int FindStopScalar (const TCHAR* text, int i, int len, const TCHAR* stops, int n) {
+for (; i<len; i++) {
+TCHAR c = text[i];
+for (int k=0; k<n; k++) if (c==stops[k]) return i;
+}
+return len;
+}
+
+#ifdef BRACKET_INDEX_SSE2
+static_assert(sizeof(TCHAR)==2, "SSE2 bracket scanning expects UTF-16 text");
+
+// Compares 8 characters at a time with all the characters which may start a bracket, string or comment
+__attribute__((target("sse2"))) static int FindStopSSE2 (const TCHAR* text, int i, int len, const TCHAR* stops, int n) {
+__m128i keys[MAX_STOP_CHARS];
+for (int k=0; k<n; k++) keys[k] = _mm_set1_epi16((short)stops[k]);
+for (; i+8<=len; i+=8) {
+__m128i v = _mm_loadu_si128((const __m128i*)(text+i)), m = _mm_cmpeq_epi16(v, keys[0]);
+for (int k=1; k<n; k++) m = _mm_or_si128(m, _mm_cmpeq_epi16(v, keys[k]));
+int mask = _mm_movemask_epi8(m);
+if (mask) return i + __builtin_ctz(mask)/2;
+}
+return FindStopScalar(text, i, len, stops, n);
+}
+
+static bool hasSSE2 = IsProcessorFeaturePresent(PF_XMMI64_INSTRUCTIONS_AVAILABLE);
+#endif
+
+static inline int FindStop (const TCHAR* text, int i, int len, const TCHAR* stops, int n) {
+#ifdef BRACKET_INDEX_SSE2
+if (hasSSE2) return FindStopSSE2(text, i, len, stops, n);
+#endif
+return FindStopScalar(text, i, len, stops, n);
+}
+
+static inline bool MatchesAt (const TCHAR* text, int i, int len, const tstring& s) {
+return !s.empty() && i+s.size()<=len && equal(s.begin(), s.end(), text+i);
+}
+
+static void AddStop (TCHAR* stops, int& n, TCHAR c) {
+if (n<MAX_STOP_CHARS && find(stops, stops+n, c)==stops+n) stops[n++] = c;
+}
+
+static void ScanBrackets (BracketIndex& s, const TCHAR* text, int len, int i) {
+const LexerProfile& lp = s.profile;
+TCHAR stops[MAX_STOP_CHARS];
+int n = 0;
+for (TCHAR c: tstring(TEXT("()[]{}"))) AddStop(stops, n, c);
+if (!lp.lineComment.empty()) AddStop(stops, n, lp.lineComment[0]);
+if (!lp.blockCommentStart.empty()) AddStop(stops, n, lp.blockCommentStart[0]);
+for (TCHAR c: lp.quotes) AddStop(stops, n, c);
+while ((i = FindStop(text, i, len, stops, n))<len) {
+TCHAR c = text[i];
+int end = -1;
+if (MatchesAt(text, i, len, lp.lineComment)) {
+for (end=i; end<len && text[end]!='\n'; end++);
+}
+else if (MatchesAt(text, i, len, lp.blockCommentStart)) {
+const TCHAR* e = search(text + i + lp.blockCommentStart.size(), text+len, lp.blockCommentEnd.begin(), lp.blockCommentEnd.end());
+end = min(len, (int)(e-text) + (int)lp.blockCommentEnd.size());
+}
+else if (lp.quotes.find(c)!=tstring::npos) {
+// Strings end at the end of the line if they aren't closed; a backslash escapes the next character
+for (end=i+1; end<len && text[end]!=c && text[end]!='\n'; end++) if (text[end]=='\\') end++;
+if (end<len && text[end]==c) end++;
+end = min(end, len);
+}
+if (end>=0) {
+s.skipStarts.push_back(i);
+s.skipEnds.push_back(end);
+i = end;
+continue;
+}
+if (IsBracket(c)) {
+s.positions.push_back(i);
+s.kinds.push_back((char)c);
+}
+i++;
+}}
+
+static void MatchBrackets (BracketIndex& s) {
+int n = s.positions.size();
+s.matches.assign(n, -1);
+s.parents.assign(n, -1);
+vector<int> open;
+for (int i=0; i<n; i++) {
+char c = s.kinds[i];
+if (IsOpeningBracket(c)) {
+s.parents[i] = open.empty()? -1 : open.back();
+open.push_back(i);
+continue;
+}
+// A closing bracket closes the nearest opening bracket of its kind; opening brackets left unclosed in between remain unmatched
+int k = open.size() -1;
+while (k>=0 && s.kinds[open[k]]!=OpeningBracketOf(c)) k--;
+if (k>=0) {
+s.matches[i] = open[k];
+s.matches[open[k]] = i;
+open.resize(k);
+}
+s.parents[i] = open.empty()? -1 : open.back();
+}}
+
+static BracketIndex& GetIndex (Page& p) {
+BracketIndex& s = bracketIndexes[&p];
+LexerProfile lp = GetLexerProfile(p);
+int from = -1, len = p.GetTextLength();
+if (!s.built || s.generation!=p.editGeneration || s.profile!=lp) from = 0;
+else if (s.dirtyFrom>=0) from = min(s.dirtyFrom, len);
+else return s;
+HLOCAL hLoc = (HLOCAL)SendMessage(p.zone, EM_GETHANDLE, 0, 0);
+LPCTSTR text = (LPCTSTR)LocalLock(hLoc);
+// Resume at the beginning of the line, or of the comment or string it is in, where the lexer state is known
+// A string or comment ending right there may also be extended by the edit, i.e. if its end was the end of the text
+while (from>0 && text[from -1]!='\n') from--;
+int k = upper_bound(s.skipStarts.begin(), s.skipStarts.end(), from) - s.skipStarts.begin() -1;
+if (from>0 && k>=0 && s.skipEnds[k]>=from) from = s.skipStarts[k];
+int count = lower_bound(s.positions.begin(), s.positions.end(), from) - s.positions.begin();
+s.positions.resize(count);
+s.kinds.resize(count);
+count = lower_bound(s.skipStarts.begin(), s.skipStarts.end(), from) - s.skipStarts.begin();
+s.skipStarts.resize(count);
+s.skipEnds.resize(count);
+s.profile = lp;
+ScanBrackets(s, text, len, from);
+LocalUnlock(hLoc);
+MatchBrackets(s);
+s.built = true;
+s.generation = p.editGeneration;
+s.dirtyFrom = -1;
+return s;
+}
+
+static int BracketAt (const BracketIndex& s, int pos) {
+auto it = lower_bound(s.positions.begin(), s.positions.end(), pos);
+return it!=s.positions.end() && *it==pos? it - s.positions.begin() : -1;
+}
+
+int export FindMatchingBracket (Page& p, int pos, int* bracket) {
+BracketIndex& s = GetIndex(p);
+int i = BracketAt(s, pos);
+if (i<0 || s.matches[i]<0) i = BracketAt(s, pos -1);
+if (i<0 || s.matches[i]<0) return -1;
+if (bracket) *bracket = s.positions[i];
+return s.positions[s.matches[i]];
+}
+
+bool export FindEnclosingBrackets (Page& p, int pos, int& start, int& end) {
+BracketIndex& s = GetIndex(p);
+int i = lower_bound(s.positions.begin(), s.positions.end(), pos) - s.positions.begin() -1;
+if (i<0) return false;
+if (!IsOpeningBracket(s.kinds[i])) i = s.parents[i];
+while (i>=0 && s.matches[i]<0) i = s.parents[i];
+if (i<0) return false;
+start = s.positions[i];
+end = s.positions[s.matches[i]];
+return true;
+}
+
+vector<tuple<int,int>> export GetBracketPairs (Page& p) {
+BracketIndex& s = GetIndex(p);
+vector<tuple<int,int>> re;
+for (int i=0; i<s.positions.size(); i++) {
+if (IsOpeningBracket(s.kinds[i]) && s.matches[i]>=0) re.push_back(make_tuple(s.positions[i], s.positions[s.matches[i]]));
+}
+return re;
+}
+
+void export InvalidateBracketIndex (Page& p, int pos) {
+auto it = bracketIndexes.find(&p);
+if (it==bracketIndexes.end()) return;
+BracketIndex& s = it->second;
+// If other edits were made meanwhile, the generation mismatch already requires a full rescan
+if (s.generation!=p.editGeneration && s.generation+1!=p.editGeneration) return;
+s.generation = p.editGeneration;
+s.dirtyFrom = s.dirtyFrom<0? pos : min(s.dirtyFrom, pos);
+}
+
+void export DiscardBracketIndex (Page* p) {
+bracketIndexes.erase(p);
+}
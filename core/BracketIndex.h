@@ -0,0 +1,23 @@
+#ifndef ___BRACKETINDEX_H9
+#define ___BRACKETINDEX_H9
+#include "global.h"
+#include<vector>
+#include<tuple>
+
+struct Page;
+
+/* Balanced pairs of (), [] and {} of a page
+Brackets inside strings and comments are ignored when a lexer profile is configured for the file extension of the page
+The index is built on first use and, after edits, rescanned from the line of the first modified position only; it must only be used from the UI thread
+*/
+// Position of the bracket matching the one at pos or, failing that, the one just before pos; -1 if there is none
+int export FindMatchingBracket (Page& page, int pos, int* bracket = NULL);
+// Innermost pair of brackets enclosing pos
+bool export FindEnclosingBrackets (Page& page, int pos, int& start, int& end);
+// All matching pairs, sorted by position of their opening bracket
+std::vector<std::tuple<int,int>> export GetBracketPairs (Page& page);
+// The text has been modified from the given position on; called once the edit control has applied the modification and editGeneration has been incremented
+void export InvalidateBracketIndex (Page& page, int pos);
+void export DiscardBracketIndex (Page* page);
+
+#endif
@@ -0,0 +1,539 @@
+#include "File.h"
+#include "Thread.h"
+#include "python34.h"
+#include<deque>
+using namespace std;
+
+#define CF_GZIP 0
+#define CF_BZIP2 1
+#define CF_XZ 2
+
+#define MAX_PENDING_CHUNKS 8
+#define INPUT_CHUNK_SIZE 262144
+#define OUTPUT_CHUNK_SIZE 1048576
+#define HISTORY_SIZE 32768
+#define FAST_BITS 9
+
+static const struct { const TCHAR *prefix, *extension; } compressionFormats[] = {
+{ TEXT("gzip:"), TEXT(".gz") },
+{ TEXT("bz2:"), TEXT(".bz2") },
+{ TEXT("xz:"), TEXT(".xz") }
+};
+
+static DWORD WaitWithoutGIL (HANDLE h) {
+if (!Py_IsInitialized() || !PyGILState_Check()) return WaitForSingleObject(h, INFINITE);
+DWORD re;
+Py_BEGIN_ALLOW_THREADS
+re = WaitForSingleObject(h, INFINITE);
+Py_END_ALLOW_THREADS
+return re;
+}
+
+struct CompressedFileReader: IO {
+IO* input;
+HANDLE thread, freeSlots, readyChunks;
+CRITICAL_SECTION cs;
+deque<string> chunks;
+string current;
+int curPos;
+volatile bool stopping, finished, failed, closed;
+
+CompressedFileReader (IO* in, const function<bool(CompressedFileReader&)>& decoder);
+int ReadInput (void* buf, int len) { return input->Read(buf, len); }
+bool Push (string& chunk);
+int Read (void* buf, int len);
+int Write (const void*, int) { return -1; }
+int size () { return -1; }
+void Flush () {}
+void Close ();
+bool IsClosed () { return closed; }
+};
+
+struct ThreadStartData {
+CompressedFileReader* reader;
+function<bool(CompressedFileReader&)> decoder;
+};
+
+static DWORD CALLBACK DecompressionThreadProc (LPVOID param) {
+ThreadStartData* d = (ThreadStartData*)param;
+CompressedFileReader& r = *d->reader;
+bool ok = false;
+try {
+ok = d->decoder(r);
+} catch (...) { ok=false; }
+delete d;
+{ SCOPE_LOCK(r.cs);
+r.failed = !ok && !r.stopping;
+r.finished = true;
+}
+ReleaseSemaphore(r.readyChunks, 1, NULL);
+return 0;
+}
+
+CompressedFileReader::CompressedFileReader (IO* in, const function<bool(CompressedFileReader&)>& decoder):
+input(in), thread(NULL), curPos(0), stopping(false), finished(false), failed(false), closed(false) {
+InitializeCriticalSection(&cs);
+freeSlots = CreateSemaphore(NULL, MAX_PENDING_CHUNKS, MAX_PENDING_CHUNKS, NULL);
+readyChunks = CreateSemaphore(NULL, 0, MAX_PENDING_CHUNKS +1, NULL);
+thread = CreateThread(NULL, 0, DecompressionThreadProc, new ThreadStartData{ this, decoder }, 0, NULL);
+}
+
+bool CompressedFileReader::Push (string& chunk) {
+if (chunk.size()<=0) return !stopping;
+WaitForSingleObject(freeSlots, INFINITE);
+if (stopping) return false;
+{ SCOPE_LOCK(cs);
+chunks.push_back(string());
+chunks.back().swap(chunk);
+}
+ReleaseSemaphore(readyChunks, 1, NULL);
+return true;
+}
+
+int CompressedFileReader::Read (void* buf, int len) {
+if (closed) return -1;
+while (curPos>=current.size()) {
+WaitWithoutGIL(readyChunks);
+SCOPE_LOCK(cs);
+if (chunks.empty()) { // Decompression is over; let further reads return immediately as well
+ReleaseSemaphore(readyChunks, 1, NULL);
+return failed? -1 : 0;
+}
+current.swap(chunks.front());
+chunks.pop_front();
+curPos = 0;
+ReleaseSemaphore(freeSlots, 1, NULL);
+}
+int n = min<int>(len, current.size() -curPos);
+memcpy(buf, current.data()+curPos, n);
+curPos += n;
+return n;
+}
+
+void CompressedFileReader::Close () {
+if (closed) return;
+closed = stopping = true;
+ReleaseSemaphore(freeSlots, 1, NULL);
+if (thread) {
+WaitWithoutGIL(thread);
+CloseHandle(thread);
+}
+input->Close();
+delete input;
+CloseHandle(freeSlots);
+CloseHandle(readyChunks);
+DeleteCriticalSection(&cs);
+chunks.clear();
+current.clear();
+}
+
+static unsigned int crc32 (unsigned int crc, const char* data, int len) {
+static unsigned int table[256] = {0};
+if (!table[1]) {
+for (unsigned int i=0; i<256; i++) {
+unsigned int c = i;
+for (int k=0; k<8; k++) c = (c&1)? 0xEDB88320 ^ (c>>1) : c>>1;
+table[i] = c;
+}}
+crc = ~crc;
+for (int i=0; i<len; i++) crc = table[(crc ^ (unsigned char)data[i]) &0xFF] ^ (crc>>8);
+return ~crc;
+}
+
+static const unsigned short lengthBase[29] = { 3, 4, 5, 6, 7, 8, 9, 10, 11, 13, 15, 17, 19, 23, 27, 31, 35, 43, 51, 59, 67, 83, 99, 115, 131, 163, 195, 227, 258 };
+static const unsigned char lengthExtra[29] = { 0, 0, 0, 0, 0, 0, 0, 0, 1, 1, 1, 1, 2, 2, 2, 2, 3, 3, 3, 3, 4, 4, 4, 4, 5, 5, 5, 5, 0 };
+static const unsigned short distBase[30] = { 1, 2, 3, 4, 5, 7, 9, 13, 17, 25, 33, 49, 65, 97, 129, 193, 257, 385, 513, 769, 1025, 1537, 2049, 3073, 4097, 6145, 8193, 12289, 16385, 24577 };
+static const unsigned char distExtra[30] = { 0, 0, 0, 0, 1, 1, 2, 2, 3, 3, 4, 4, 5, 5, 6, 6, 7, 7, 8, 8, 9, 9, 10, 10, 11, 11, 12, 12, 13, 13 };
+static const unsigned char codeLengthOrder[19] = { 16, 17, 18, 0, 8, 7, 9, 6, 10, 5, 11, 4, 12, 3, 13, 2, 14, 1, 15 };
+
+struct Huffman {
+short count[16], symbol[288];
+unsigned short fast[1<<FAST_BITS]; // (length<<9) | symbol for codes up to FAST_BITS bits long, 0 otherwise
+bool build (const unsigned char* lengths, int n);
+};
+
+bool Huffman::build (const unsigned char* lengths, int n) {
+short offsets[16];
+int next[16];
+memset(count, 0, sizeof(count));
+memset(fast, 0, sizeof(fast));
+for (int i=0; i<n; i++) count[lengths[i]]++;
+count[0] = 0;
+int left = 1;
+for (int len=1; len<=15; len++) {
+left = (left<<1) - count[len];
+if (left<0) return false; // Over-subscribed code
+}
+offsets[1] = 0;
+for (int len=1; len<15; len++) offsets[len+1] = offsets[len] + count[len];
+for (int i=0; i<n; i++) if (lengths[i]) symbol[offsets[lengths[i]]++] = i;
+int code = 0;
+for (int len=1; len<=15; len++) next[len] = code = (code + count[len -1]) <<1;
+for (int i=0; i<n; i++) {
+int len = lengths[i];
+if (len<=0) continue;
+int c = next[len]++;
+if (len>FAST_BITS) continue;
+int rev = 0;
+for (int k=0; k<len; k++) rev |= ((c>>k)&1) << (len -1 -k);
+for (int j=rev; j<(1<<FAST_BITS); j+=(1<<len)) fast[j] = (len<<9) | i;
+}
+return true;
+}
+
+struct Inflater {
+CompressedFileReader& reader;
+vector<char> in, out;
+int inPos, inLen, outPos, outEmitted, bitcnt;
+unsigned int bitbuf, crc, memberSize;
+
+Inflater (CompressedFileReader& r): reader(r), in(INPUT_CHUNK_SIZE), out(OUTPUT_CHUNK_SIZE + HISTORY_SIZE), inPos(0), inLen(0), outPos(0), outEmitted(0), bitcnt(0), bitbuf(0), crc(0), memberSize(0) {}
+
+bool refill () {
+if (reader.stopping) throw 1;
+inLen = reader.ReadInput(&in[0], in.size());
+inPos = 0;
+if (inLen<0) inLen=0;
+return inLen>0;
+}
+
+inline bool moreInput () {
+return bitcnt>0 || inPos<inLen || refill();
+}
+
+inline void fillBits () {
+while (bitcnt<=24) {
+if (inPos>=inLen && !refill()) break;
+bitbuf |= (unsigned int)(unsigned char)in[inPos++] << bitcnt;
+bitcnt += 8;
+}}
+
+inline int bits (int n) {
+while (bitcnt<n) {
+if (inPos>=inLen && !refill()) throw 1; // Truncated stream
+bitbuf |= (unsigned int)(unsigned char)in[inPos++] << bitcnt;
+bitcnt += 8;
+}
+int re = bitbuf & ((1<<n) -1);
+bitbuf >>= n;
+bitcnt -= n;
+return re;
+}
+
+inline int decode (const Huffman& h) {
+fillBits();
+int e = h.fast[bitbuf & ((1<<FAST_BITS) -1)];
+if (e && (e>>9)<=bitcnt) {
+bitbuf >>= (e>>9);
+bitcnt -= (e>>9);
+return e&511;
+}
+int code=0, first=0, index=0;
+for (int len=1; len<=15 && len<=bitcnt; len++) {
+code |= (bitbuf>>(len -1)) &1;
+int c = h.count[len];
+if (code - c < first) {
+bitbuf >>= len;
+bitcnt -= len;
+return h.symbol[index + code - first];
+}
+index += c;
+first = (first + c) <<1;
+code <<= 1;
+}
+throw 1;
+}
+
+void emit () {
+if (outPos<=outEmitted) return;
+crc = crc32(crc, &out[outEmitted], outPos - outEmitted);
+memberSize += outPos - outEmitted;
+string chunk(&out[outEmitted], outPos - outEmitted);
+if (!reader.Push(chunk)) throw 1;
+int keep = min(outPos, HISTORY_SIZE);
+memmove(&out[0], &out[outPos -keep], keep);
+outPos = outEmitted = keep;
+}
+
+inline void reserve (int n) {
+if (outPos+n > out.size()) emit();
+}
+
+void storedBlock () {
+bitbuf >>= (bitcnt&7);
+bitcnt -= (bitcnt&7);
+int len = bits(16), nlen = bits(16);
+if (len != (~nlen & 0xFFFF)) throw 1;
+while (len>0 && bitcnt>=8) {
+reserve(1);
+out[outPos++] = bits(8);
+len--;
+}
+while (len>0) {
+if (inPos>=inLen && !refill()) throw 1;
+reserve(1);
+int n = min(len, min<int>(inLen-inPos, out.size()-outPos));
+memcpy(&out[outPos], &in[inPos], n);
+outPos+=n; inPos+=n; len-=n;
+}}
+
+void codes (const Huffman& lencode, const Huffman& distcode) {
+while(true) {
+int sym = decode(lencode);
+if (sym<256) {
+reserve(1);
+out[outPos++] = sym;
+}
+else if (sym==256) break;
+else {
+sym -= 257;
+if (sym>=29) throw 1;
+int len = lengthBase[sym] + bits(lengthExtra[sym]);
+int dsym = decode(distcode);
+if (dsym>=30) throw 1;
+int dist = distBase[dsym] + bits(distExtra[dsym]);
+reserve(len);
+if (dist>outPos) throw 1;
+char *dst = &out[outPos], *src = dst - dist;
+if (dist>=len) memcpy(dst, src, len);
+else for (int i=0; i<len; i++) dst[i] = src[i];
+outPos += len;
+}}}
+
+void fixedBlock () {
+static Huffman lencode, distcode;
+static bool built = false;
+if (!built) {
+unsigned char lengths[288];
+int i=0;
+for (; i<144; i++) lengths[i]=8;
+for (; i<256; i++) lengths[i]=9;
+for (; i<280; i++) lengths[i]=7;
+for (; i<288; i++) lengths[i]=8;
+lencode.build(lengths, 288);
+for (i=0; i<30; i++) lengths[i]=5;
+distcode.build(lengths, 30);
+built = true;
+}
+codes(lencode, distcode);
+}
+
+void dynamicBlock () {
+unsigned char lengths[320];
+Huffman lencode, distcode;
+int nlen = bits(5) +257, ndist = bits(5) +1, ncode = bits(4) +4;
+if (nlen>286 || ndist>30) throw 1;
+memset(lengths, 0, sizeof(lengths));
+for (int i=0; i<ncode; i++) lengths[codeLengthOrder[i]] = bits(3);
+if (!lencode.build(lengths, 19)) throw 1;
+for (int i=0; i<nlen+ndist; ) {
+int sym = decode(lencode), len = 0, rep = 0;
+if (sym<16) { lengths[i++] = sym; continue; }
+else if (sym==16) {
+if (i<=0) throw 1;
+len = lengths[i -1];
+rep = 3 + bits(2);
+}
+else if (sym==17) rep = 3 + bits(3);
+else rep = 11 + bits(7);
+if (i+rep > nlen+ndist) throw 1;
+while (rep--) lengths[i++] = len;
+}
+if (!lengths[256]) throw 1;
+if (!lencode.build(lengths, nlen) || !distcode.build(lengths+nlen, ndist)) throw 1;
+codes(lencode, distcode);
+}
+
+bool header () {
+if (bits(8)!=31 || bits(8)!=139) return false;
+if (bits(8)!=8) throw 1; // Only deflate is defined
+int flags = bits(8);
+for (int i=0; i<6; i++) bits(8); // mtime, extra flags, OS
+if (flags&4) { // FEXTRA
+int n = bits(16);
+while (n--) bits(8);
+}
+if (flags&8) while (bits(8)); // FNAME
+if (flags&16) while (bits(8)); // FCOMMENT
+if (flags&2) bits(16); // FHCRC
+return true;
+}
+
+void blocks () {
+int last;
+do {
+last = bits(1);
+switch(bits(2)){
+case 0: storedBlock(); break;
+case 1: fixedBlock(); break;
+case 2: dynamicBlock(); break;
+default: throw 1;
+}
+} while(!last);
+emit();
+}
+
+// Trailing garbage after a complete member, i.e. which doesn't start with a full gzip header, is ignored
+bool nextMember (bool first) {
+if (!moreInput()) return false;
+try { return header(); }
+catch (int) {
+if (first) throw;
+return false;
+}}
+
+bool gunzip () {
+bool first = true;
+// A gzip file can be made of several concatenated members
+while (nextMember(first)) {
+first = false;
+crc = memberSize = 0;
+blocks();
+bitbuf >>= (bitcnt&7);
+bitcnt -= (bitcnt&7);
+// Separate statements, since the order of evaluation of operands is unspecified
+unsigned int crcLow = bits(16);
+unsigned int crcHigh = bits(16);
+unsigned int sizeLow = bits(16);
+unsigned int sizeHigh = bits(16);
+if ((crcLow | (crcHigh<<16))!=crc || (sizeLow | (sizeHigh<<16))!=memberSize) throw 1;
+}
+return !first;
+}
+};
+
+IO* CreateInflatingReader (IO* input, unsigned int expectedCrc, unsigned int expectedSize) {
+return new CompressedFileReader(input, [=](CompressedFileReader& r){ 
+Inflater inflater(r);
+inflater.blocks();
+return inflater.crc==expectedCrc && inflater.memberSize==expectedSize;
+});
+}
+
+static PyObject* CreateCodecObject (int format, bool compress) {
+PyObject *mod = NULL, *obj = NULL;
+switch(format){
+case CF_GZIP:
+if (mod = PyImport_ImportModule("zlib")) obj = compress? PyObject_CallMethod(mod, "compressobj", "iii", 6, 8, 31) : PyObject_CallMethod(mod, "decompressobj", "i", 31);
+break;
+case CF_BZIP2:
+if (mod = PyImport_ImportModule("bz2")) obj = PyObject_CallMethod(mod, compress? "BZ2Compressor" : "BZ2Decompressor", NULL);
+break;
+case CF_XZ:
+if (mod = PyImport_ImportModule("lzma")) obj = PyObject_CallMethod(mod, compress? "LZMACompressor" : "LZMADecompressor", NULL);
+break;
+}
+Py_XDECREF(mod);
+if (!obj) PyErr_Clear();
+return obj;
+}
+
+static bool AppendBytes (PyObject* bytes, string& out) {
+if (!bytes) { PyErr_Clear(); return false; }
+out.append(PyBytes_AS_STRING(bytes), PyBytes_GET_SIZE(bytes));
+Py_DECREF(bytes);
+return true;
+}
+
+static bool PyDecompress (PyObject*& codec, int format, const char* data, int len, string& out) {
+if (!AppendBytes(PyObject_CallMethod(codec, "decompress", "y#", data, len), out)) return false;
+PyObject* eof = PyObject_GetAttrString(codec, "eof");
+bool ended = eof && PyObject_IsTrue(eof);
+Py_XDECREF(eof);
+if (!ended) { PyErr_Clear(); return true; }
+// Start of another concatenated stream
+PyObject* unused = PyObject_GetAttrString(codec, "unused_data");
+string rest;
+if (unused) AppendBytes(unused, rest);
+PyErr_Clear();
+if (rest.size()<=0) return true;
+Py_DECREF(codec);
+if (!(codec = CreateCodecObject(format, false))) return false;
+return PyDecompress(codec, format, rest.data(), rest.size(), out);
+}
+
+static bool PyDecompressionLoop (CompressedFileReader& r, int format) {
+PyObject* codec = NULL;
+{ GIL_PROTECT codec = CreateCodecObject(format, false); }
+if (!codec) return false;
+string in(INPUT_CHUNK_SIZE, '\0'), out;
+int n = 0;
+bool ok = true;
+while (ok && !r.stopping && (n = r.ReadInput(&in[0], in.size()))>0) {
+{ GIL_PROTECT ok = PyDecompress(codec, format, in.data(), n, out); }
+if (!r.Push(out)) break;
+}
+{ GIL_PROTECT Py_XDECREF(codec); }
+return ok && n>=0;
+}
+
+struct CompressedFileWriter: IO {
+IO* output;
+PyObject* codec;
+bool closed;
+
+CompressedFileWriter (IO* out, PyObject* c): output(out), codec(c), closed(!c || !out || out->IsClosed()) {}
+
+bool WriteAll (const string& data) {
+int pos=0, n=0;
+while (pos<data.size() && (n = output->Write(data.data()+pos, data.size() -pos))>0) pos+=n;
+return pos>=data.size();
+}
+
+int Write (const void* buf, int len) {
+if (closed) return -1;
+if (len<0) len = strlen((const char*)buf);
+string data;
+bool ok;
+{ GIL_PROTECT ok = AppendBytes(PyObject_CallMethod(codec, "compress", "y#", (const char*)buf, len), data); }
+if (!ok || !WriteAll(data)) return -1;
+return len;
+}
+
+void Close () {
+if (!closed && codec) {
+string data;
+{ GIL_PROTECT AppendBytes(PyObject_CallMethod(codec, "flush", NULL), data); }
+WriteAll(data);
+}
+if (codec) { GIL_PROTECT Py_DECREF(codec); }
+codec = NULL;
+closed = true;
+if (output) {
+output->Close();
+delete output;
+output = NULL;
+}}
+
+int Read (void*, int) { return -1; }
+int size () { return -1; }
+void Flush () { if (output) output->Flush(); }
+bool IsClosed () { return closed; }
+};
+
+static IO* OpenCompressedFile (int format, const tstring& path, bool write, bool append) {
+// A failing IO rather than NULL, so that the file isn't opened as a plain file instead
+if ((write || format!=CF_GZIP) && !Py_IsInitialized()) return new CompressedFileWriter(NULL, NULL);
+PyObject* codec = NULL;
+if (write) { GIL_PROTECT codec = CreateCodecObject(format, true); }
+IO* io = (!write || codec? File::openIO(path, write, append, false) : NULL);
+// Failing is better than silently writing uncompressed data
+if (write) return new CompressedFileWriter(io, codec);
+if (!io || io->IsClosed()) return io;
+else if (format==CF_GZIP) return new CompressedFileReader(io, [](CompressedFileReader& r){ return Inflater(r).gunzip(); });
+else return new CompressedFileReader(io, [=](CompressedFileReader& r){ return PyDecompressionLoop(r, format); });
+}
+
+IO* CompressedFileProtocolHandler (const tstring& uri, bool write, bool append) {
+for (int i=0; i<sizeof(compressionFormats)/sizeof(compressionFormats[0]); i++) {
+if (starts_with(uri, compressionFormats[i].prefix)) return OpenCompressedFile(i, uri.substr(tstrlen(compressionFormats[i].prefix)), write, append);
+}
+return NULL;
+}
+
+IO* CompressedFileHandler (const tstring& path, bool write, bool append) {
+for (int i=0; i<sizeof(compressionFormats)/sizeof(compressionFormats[0]); i++) {
+if (boost::iends_with(path, compressionFormats[i].extension)) return OpenCompressedFile(i, path, write, append);
+}
+return NULL;
+}
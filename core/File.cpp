@@ -3,9 +3,11 @@
 using namespace std;
 
 struct StdFile: IO {
-HANDLE fd;
+HANDLE fd, mapping;
+const char* mapped;
+int mappedSize;
 
-StdFile (HANDLE h=0): fd(h) {}
+StdFile (HANDLE h=0): fd(h), mapping(NULL), mapped(NULL), mappedSize(-1) {}
 
 int size () {
 DWORD size = GetFileSize(fd, NULL);
@@ -28,8 +30,33 @@ if (WriteFile(fd, buf, len, &nWritten, NULL)) return nWritten;
 else { Close(); return -1; }
 }
 
+bool Seek (long long pos) {
+LARGE_INTEGER li;
+li.QuadPart = pos;
+return !IsClosed() && SetFilePointerEx(fd, li, NULL, FILE_BEGIN);
+}
+
+boost::string_ref View () {
+if (mappedSize<0 && !IsClosed()) {
+mappedSize = 0;
+int len = size();
+if (len>0 && (mapping = CreateFileMapping(fd, NULL, PAGE_READONLY, 0, 0, NULL))) {
+mapped = (const char*)MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0);
+if (mapped) mappedSize = len;
+}}
+if (!mapped) return boost::string_ref();
+return boost::string_ref(mapped, mappedSize);
+}
+
+void Unmap () {
+if (mapped) UnmapViewOfFile(mapped);
+if (mapping) CloseHandle(mapping);
+mapped = NULL;
+mapping = NULL;
+}
+
 void Flush () { if (fd) FlushFileBuffers(fd); }
-void Close () { if (fd) CloseHandle(fd); fd=INVALID_HANDLE_VALUE; }
+void Close () { Unmap(); if (fd) CloseHandle(fd); fd=INVALID_HANDLE_VALUE; }
 bool IsClosed () { return !fd || fd==INVALID_HANDLE_VALUE; }
 
 static StdFile* Open (const tstring& path, bool write, bool append) {
@@ -46,6 +73,8 @@ struct StdFilePipe: StdFile {
 using StdFile::StdFile;
 void Close () {}
 int size () { return -1; }
+bool Seek (long long pos) { return false; }
+boost::string_ref View () { return boost::string_ref(); }
 };
 
 IO* FileURIProtocolHandler (const tstring& uri, bool write, bool append) {
@@ -65,6 +94,7 @@ else return NULL;
 }
 
 void export File::close () { 
+bufPos = bufEnd = 0;
 if (io){
 io->Close();
 delete io;
@@ -75,19 +105,103 @@ void export File::flush () {
 if (io) io->Flush();
 }
 
-bool export File::open (const tstring& path, bool write, bool append) {
+IO* export File::openIO (const tstring& path, bool write, bool append, bool useFileHandlers) {
+IO* io = NULL;
 int dot = path.find(':');
 if (dot>1 && dot<=5) { // Handling custom protocols
-for (auto handler: protocolHandlers) {
-if (io = handler(path, write, append)) break;
+for (auto& handler: protocolHandlers) {
+if (io = handler(path, write, append)) return io;
+}}
+if (useFileHandlers) { // Handlers for particular file types, e.g. compressed files
+for (auto& handler: fileHandlers) {
+if (io = handler(path, write, append)) return io;
 }}
-if (!io) io = StdFile::Open(path, write, append);
+return StdFile::Open(path, write, append);
+}
+
+bool export File::open (const tstring& path, bool write, bool append) {
+io = openIO(path, write, append);
 return !!io;
 }
 
+int File::fill () {
+if (!io) return -1;
+if (bufPos>0) {
+if (bufEnd>bufPos) memmove(&buffer[0], &buffer[bufPos], bufEnd-bufPos);
+bufEnd -= bufPos;
+bufPos = 0;
+}
+if (buffer.size()<bufferSize) buffer.resize(bufferSize);
+else if (bufEnd>=buffer.size()) buffer.resize(buffer.size()*2); // A line longer than the buffer
+int n = io->Read(&buffer[bufEnd], buffer.size()-bufEnd);
+if (n>0) bufEnd+=n;
+return n;
+}
+
+void export File::setBufferSize (int size) {
+if (size<16) size=16;
+bufferSize = size;
+if (bufEnd-bufPos>size) return;
+if (bufPos>0 && bufEnd>bufPos) memmove(&buffer[0], &buffer[bufPos], bufEnd-bufPos);
+bufEnd -= bufPos;
+bufPos = 0;
+buffer.resize(size);
+buffer.shrink_to_fit();
+}
+
 int export File::read (void* buf, int len) {
-if (io) return io->Read(buf,len);
-else return -1;
+if (len<=0) return 0;
+if (bufPos<bufEnd) {
+int n = min(len, bufEnd-bufPos);
+memcpy(buf, &buffer[bufPos], n);
+bufPos+=n;
+return n;
+}
+if (!io) return -1;
+else if (len>=bufferSize) return io->Read(buf,len);
+int n = fill();
+if (n<=0) return n;
+n = min(len, n);
+memcpy(buf, &buffer[bufPos], n);
+bufPos+=n;
+return n;
+}
+
+boost::string_ref export File::peek (int len) {
+while (bufEnd-bufPos<len && fill()>0);
+if (bufEnd<=bufPos) return boost::string_ref();
+return boost::string_ref(&buffer[bufPos], min(len, bufEnd-bufPos));
+}
+
+bool export File::seek (long long pos) {
+if (!io || !io->Seek(pos)) return false;
+bufPos = bufEnd = 0;
+return true;
+}
+
+boost::string_ref export File::view () {
+if (!io) return boost::string_ref();
+return io->View();
+}
+
+bool export File::readLine (boost::string_ref& line, char lim) {
+int scanned = 0;
+const char *start, *p;
+while(true) {
+start = buffer.data() + bufPos;
+if (bufEnd-bufPos>scanned && (p = (const char*)memchr(start+scanned, lim, bufEnd-bufPos-scanned))) break;
+scanned = bufEnd-bufPos;
+if (fill()<=0) {
+if (bufEnd<=bufPos) { close(); return false; }
+start = buffer.data() + bufPos;
+p = buffer.data() + bufEnd;
+break;
+}}
+int len = p-start;
+bufPos = min(bufPos+len+1, bufEnd);
+if (len>0 && start[len -1]=='\r') len--;
+line = boost::string_ref(start, len);
+return true;
 }
 
 int export File::write (const void* buf, int len) {
@@ -123,15 +237,20 @@ return pos>=len;
 }
 
 string export File::readUntil (char lim, char ign) {
-int n;
-char c;
 string s = "";
-while((n=read(&c,1))>0) {
-if (c==ign) continue;
-else if (c==lim) break;
-s+=c;
+while(true) {
+if (bufPos>=bufEnd && fill()<=0) { close(); break; }
+const char *start = buffer.data()+bufPos, *end = buffer.data()+bufEnd;
+const char *p = (const char*)memchr(start, lim, end-start), *stop = p? p : end;
+for (const char* q = start; q<stop; ) {
+const char* r = (const char*)memchr(q, ign, stop-q);
+if (!r) r = stop;
+s.append(q, r-q);
+q = r+1;
+}
+bufPos = (p? p+1 : end) - buffer.data();
+if (p) break;
 }
-if (n<=0) close();
 return s;
 }
 
@@ -150,8 +269,22 @@ void export File::registerHandler (const function<IO*(const tstring&,bool,bool)>
 File::protocolHandlers.push_back(f);
 }
 
+void export File::registerFileHandler (const function<IO*(const tstring&,bool,bool)>& f) {
+File::fileHandlers.push_back(f);
+}
+
+IO* CompressedFileProtocolHandler (const tstring& uri, bool write, bool append);
+IO* CompressedFileHandler (const tstring& path, bool write, bool append);
+IO* ZipProtocolHandler (const tstring& uri, bool write, bool append);
+
 vector<function<IO*(const tstring&,bool,bool)>> File::protocolHandlers = {
 FileURIProtocolHandler,
-StdstreamsProtocolHandler
+StdstreamsProtocolHandler,
+CompressedFileProtocolHandler,
+ZipProtocolHandler
+};
+
+vector<function<IO*(const tstring&,bool,bool)>> File::fileHandlers = {
+CompressedFileHandler
 };
 
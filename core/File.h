@@ -1,6 +1,7 @@
 #ifndef ___FILE_H9
 #define ___FILE_H9
 #include "global.h"
+#include<boost/utility/string_ref.hpp>
 
 struct IO {
 virtual int Read (void*, int) = 0;
@@ -9,10 +10,15 @@ virtual int size () = 0;
 virtual void Flush () = 0;
 virtual void Close () = 0;
 virtual bool IsClosed () = 0;
+virtual boost::string_ref View () { return boost::string_ref(); }
+virtual bool Seek (long long pos) { return false; }
+virtual ~IO () {}
 };
 
 struct export File {
 IO* io;
+std::vector<char> buffer;
+int bufferSize, bufPos, bufEnd;
 bool export open (const tstring& path, bool write=false, bool append=false);
 int export read (void* buf, int len);
 int export write (const void* buf, int len = -1);
@@ -21,10 +27,17 @@ bool export writeFully (const void* buf, int len) ;
 string export readFully () ;
 string export readUntil (char c = '\n', char ign = '\r') ;
 inline string readLine () { return readUntil(); }
+// The view points into the read buffer and is only valid until the next read operation
+bool export readLine (boost::string_ref& line, char lim = '\n') ;
+boost::string_ref export peek (int len) ;
+// Whole content of the file, mapped in memory without copy, valid until the file is closed. Empty if the file can't be mapped, e.g. pipes and standard streams; use read or readFully in that case
+boost::string_ref export view () ;
+void export setBufferSize (int size) ;
+bool export seek (long long pos) ;
 void export close () ;
 void export flush () ;
-inline File () : io(0)  { }
-inline File (const tstring& path, bool write=false, bool append=false): io(0) { open(path,write, append); }
+inline File () : io(0), bufferSize(65536), bufPos(0), bufEnd(0)  { }
+inline File (const tstring& path, bool write=false, bool append=false): io(0), bufferSize(65536), bufPos(0), bufEnd(0) { open(path,write, append); }
 inline File (const File&) = delete;
 inline File (File&&) = default;
 inline File& operator= (const File&) = delete;
@@ -36,8 +49,15 @@ inline File& operator<< (const char* s) { return operator<<(string(s)); }
 template<class T> inline File& operator<< (const T& x) { return operator<<(toString(x)); }
 
 static void export normalizePath (tstring& filename);
+static IO* export openIO (const tstring& path, bool write=false, bool append=false, bool useFileHandlers=true);
 static void export registerHandler (const function<IO*(const tstring&,bool, bool)>&);
-static std::vector<std::function<IO*(const tstring&, bool, bool)>> protocolHandlers;
+static void export registerFileHandler (const function<IO*(const tstring&,bool, bool)>&);
+static std::vector<std::function<IO*(const tstring&, bool, bool)>> protocolHandlers, fileHandlers;
+private:
+int fill () ;
 };
 
+// Names of the members of a zip archive, which can be opened as zip://archive.zip!/member
+std::vector<tstring> export ListZipArchive (const tstring& archive);
+
 #endif
\ No newline at end of file
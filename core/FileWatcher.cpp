@@ -0,0 +1,113 @@
+#include "FileWatcher.h"
+#include "page.h"
+#include "Thread.h"
+#include<algorithm>
+using namespace std;
+
+#define WATCH_COALESCE_DELAY 100
+#define WATCH_POLL_INTERVAL 2000
+
+struct WatchedFile {
+Page* key;
+weak_ptr<Page> page;
+tstring file, directory;
+unsigned long long lastModified;
+};
+
+struct WatchedDirectory {
+tstring path;
+HANDLE handle;
+};
+
+static CRITICAL_SECTION watchLock;
+static HANDLE watchListChanged;
+static vector<WatchedFile> watchedFiles;
+static bool watchThreadStarted = false;
+static struct WatchInit { WatchInit () { InitializeCriticalSection(&watchLock); watchListChanged = CreateEvent(NULL, FALSE, FALSE, NULL); } } watchInit;
+
+static bool IsWatchable (const tstring& file) {
+// Only local and network paths; protocols such as zip:// or gzip: aren't watched
+return file.size()>3 && ((file[1]==':' && (file[2]=='\\' || file[2]=='/')) || starts_with(file, TEXT("\\\\")));
+}
+
+static void CheckDirectories (const vector<tstring>& dirs) {
+vector<WatchedFile> candidates;
+{ SCOPE_LOCK(watchLock);
+for (auto& w: watchedFiles) if (find(dirs.begin(), dirs.end(), w.directory)!=dirs.end()) candidates.push_back(w);
+}
+for (auto& w: candidates) {
+unsigned long long lastModified = GetFileTime(w.file.c_str(), LAST_MODIFIED_TIME);
+if (lastModified<=0 || lastModified==w.lastModified) continue;
+{ SCOPE_LOCK(watchLock);
+for (auto& x: watchedFiles) if (x.key==w.key && x.file==w.file) x.lastModified = lastModified;
+}
+weak_ptr<Page> wp = w.page;
+RunAsync([=]()mutable{
+shared_ptr<Page> p = wp.lock();
+if (p) p->OnFileChangedOnDisk(lastModified);
+});
+}}
+
+static void WatchThreadProc () {
+vector<WatchedDirectory> dirs;
+while(true) {
+vector<tstring> wanted, polled, changed;
+{ SCOPE_LOCK(watchLock);
+for (auto& w: watchedFiles) if (find(wanted.begin(), wanted.end(), w.directory)==wanted.end()) wanted.push_back(w.directory);
+}
+for (int i=dirs.size() -1; i>=0; i--) {
+if (find(wanted.begin(), wanted.end(), dirs[i].path)!=wanted.end()) continue;
+if (dirs[i].handle) FindCloseChangeNotification(dirs[i].handle);
+dirs.erase(dirs.begin()+i);
+}
+for (auto& d: wanted) {
+if (find_if(dirs.begin(), dirs.end(), [&](const WatchedDirectory& x){ return x.path==d; })!=dirs.end()) continue;
+HANDLE h = FindFirstChangeNotification(d.c_str(), FALSE, FILE_NOTIFY_CHANGE_LAST_WRITE | FILE_NOTIFY_CHANGE_FILE_NAME | FILE_NOTIFY_CHANGE_SIZE);
+dirs.push_back({ d, h==INVALID_HANDLE_VALUE? NULL : h });
+}
+vector<HANDLE> handles = { watchListChanged };
+vector<int> indices;
+for (int i=0; i<dirs.size(); i++) {
+// Directories which can't be watched, or exceeding the maximum number of handles we can wait on, are polled
+if (dirs[i].handle && handles.size()<MAXIMUM_WAIT_OBJECTS) { handles.push_back(dirs[i].handle); indices.push_back(i); }
+else polled.push_back(dirs[i].path);
+}
+DWORD re = WaitForMultipleObjects(handles.size(), &handles[0], FALSE, polled.size()>0? WATCH_POLL_INTERVAL : INFINITE);
+if (re==WAIT_OBJECT_0) continue;
+else if (re==WAIT_TIMEOUT) changed = polled;
+else if (re>WAIT_OBJECT_0 && re<WAIT_OBJECT_0+handles.size()) {
+// Coalesce bursts of notifications, e.g. a program writing a file in several steps
+Sleep(WATCH_COALESCE_DELAY);
+for (int i=1; i<handles.size(); i++) {
+if (WaitForSingleObject(handles[i], 0)!=WAIT_OBJECT_0) continue;
+changed.push_back(dirs[indices[i -1]].path);
+FindNextChangeNotification(handles[i]);
+}}
+else Sleep(WATCH_POLL_INTERVAL);
+CheckDirectories(changed);
+}}
+
+void export WatchFile (const shared_ptr<Page>& page) {
+if (!page) return;
+if (!IsWatchable(page->file)) { UnwatchFile(page.get()); return; }
+tstring dir = page->file.substr(0, page->file.find_last_of(TEXT("\\/")));
+{ SCOPE_LOCK(watchLock);
+auto it = find_if(watchedFiles.begin(), watchedFiles.end(), [&](const WatchedFile& w){ return w.key==page.get(); });
+if (it!=watchedFiles.end() && it->file==page->file) return;
+else if (it!=watchedFiles.end()) watchedFiles.erase(it);
+watchedFiles.push_back({ page.get(), page, page->file, dir, 0 });
+if (!watchThreadStarted) {
+watchThreadStarted = true;
+Thread::start(WatchThreadProc);
+}}
+SetEvent(watchListChanged);
+}
+
+void export UnwatchFile (Page* page) {
+{ SCOPE_LOCK(watchLock);
+auto it = find_if(watchedFiles.begin(), watchedFiles.end(), [&](const WatchedFile& w){ return w.key==page; });
+if (it==watchedFiles.end()) return;
+watchedFiles.erase(it);
+}
+SetEvent(watchListChanged);
+}
@@ -0,0 +1,12 @@
+#ifndef ___FILEWATCHER_H9
+#define ___FILEWATCHER_H9
+#include "global.h"
+#include<memory>
+
+struct Page;
+
+// Watch the file of a page on a background thread; Page::OnFileChangedOnDisk is called on the UI thread when the file is modified by another application
+void export WatchFile (const std::shared_ptr<Page>& page);
+void export UnwatchFile (Page* page);
+
+#endif
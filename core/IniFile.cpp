@@ -23,11 +23,24 @@ return true;
 }
 
 
+static bool nextLine (boost::string_ref& data, boost::string_ref& line) {
+if (data.size()<=0) return false;
+size_t pos = data.find('\n');
+if (pos==boost::string_ref::npos) pos = data.size();
+line = data.substr(0, pos);
+data.remove_prefix(min(pos+1, data.size()));
+return true;
+}
+
 bool export IniFile::load (const tstring& fn) {
 File f(fn);
 if (!f) return false;
 string section = "";
-for (string line: split(f.readFully(), "\n")) {
+boost::string_ref data = f.view(), ref;
+// The view doesn't move the buffered reader, so the two must never be mixed
+bool mapped = data.size()>0;
+while (mapped? nextLine(data, ref) : f.readLine(ref)) {
+string line = ref.to_string();
 trim(line);
 if (line.size()<1 || line[0]=='#' || line[0]==';') continue;
 if (line[0]=='[') {
@@ -0,0 +1,69 @@
+#ifndef ___MPSCQUEUE_H9
+#define ___MPSCQUEUE_H9
+#include<atomic>
+#include<utility>
+
+/* Unbounded lock-free queue with any number of producers and a single consumer
+Producers only swap the head pointer and link the previous node, so that they never wait for each other nor for the consumer
+Pop may return false while a producer is between these two steps; the item becomes visible as soon as the producer completes its push
+*/
+template<class T> class MPSCQueue {
+struct Node {
+std::atomic<Node*> next;
+T value;
+Node (): next(nullptr) {}
+Node (T&& v): next(nullptr), value(std::move(v)) {}
+};
+std::atomic<Node*> head;
+Node* tail;
+Node stub;
+std::atomic<int> count;
+
+void pushNode (Node* n) {
+n->next.store(nullptr, std::memory_order_relaxed);
+Node* prev = head.exchange(n, std::memory_order_acq_rel);
+prev->next.store(n, std::memory_order_release);
+}
+
+public:
+MPSCQueue (): head(&stub), tail(&stub), count(0) {}
+~MPSCQueue () {
+T x;
+while (pop(x));
+}
+MPSCQueue (const MPSCQueue&) = delete;
+MPSCQueue& operator= (const MPSCQueue&) = delete;
+
+// May be called from any thread; returns the number of items in the queue, including this one
+int push (T&& value) {
+int n = count.fetch_add(1, std::memory_order_relaxed) +1;
+pushNode(new Node(std::move(value)));
+return n;
+}
+
+// Must only be called from the consumer thread
+bool pop (T& value) {
+Node* t = tail;
+Node* next = t->next.load(std::memory_order_acquire);
+if (t==&stub) {
+if (!next) return false;
+tail = t = next;
+next = next->next.load(std::memory_order_acquire);
+}
+if (!next) {
+if (t!=head.load(std::memory_order_acquire)) return false;
+pushNode(&stub);
+next = t->next.load(std::memory_order_acquire);
+if (!next) return false;
+}
+tail = next;
+value = std::move(t->value);
+delete t;
+count.fetch_sub(1, std::memory_order_relaxed);
+return true;
+}
+
+int size () const { return count.load(std::memory_order_relaxed); }
+};
+
+#endif
@@ -1,6 +1,8 @@
 #include "global.h"
 #include "strings.hpp"
 #include "page.h"
+#include "StructureIndex.h"
+#include "BracketIndex.h"
 #include "thread.h"
 #include "python34.h"
 //#include<boost/weak_ptr.hpp>
@@ -8,6 +10,9 @@ using namespace std;
 
 extern vector<shared_ptr<Page>> pages;
 
+static PyObject* CreatePyTextView (const shared_ptr<Page>& p, const shared_ptr<const tstring>& text, unsigned int generation, bool snapshot);
+static PyObject* CreatePyLineIterator (const shared_ptr<const tstring>& text, int start, int end);
+
 struct PyProxyUndoState: UndoState  {
 PySafeObject obj;
 PyProxyUndoState (const PySafeObject& o): obj(o) {}
@@ -49,13 +54,36 @@ void setEncoding (int e) { RunSync([&]()mutable{ page()->SetEncoding(e); }); }
 void setIndentationMode (int i) { RunSync([&]()mutable{ page()->SetIndentationMode(i); }); }
 void setTabWidth (int i) { RunSync([&]()mutable{ page()->SetTabWidth(i); }); }
 void setAutoLineBreak (bool b) { RunSync([&]()mutable{ page()->SetAutoLineBreak(b); }); }
+bool getTrimTrailingWhitespace () { return 0!=(page()->flags&PF_TRIMTRAILINGSPACES); }
+void setTrimTrailingWhitespace (bool b) { if (b) page()->flags|=PF_TRIMTRAILINGSPACES; else page()->flags&=~PF_TRIMTRAILINGSPACES; }
+bool getInsertFinalNewline () { return 0!=(page()->flags&PF_INSERTFINALNEWLINE); }
+void setInsertFinalNewline (bool b) { if (b) page()->flags|=PF_INSERTFINALNEWLINE; else page()->flags&=~PF_INSERTFINALNEWLINE; }
+bool getTail () { return 0!=(page()->flags&PF_TAIL); }
+void setTail (bool b) { RunSync([&]()mutable{ page()->SetTail(b); }); }
+bool getTailFollow () { return 0!=(page()->flags&PF_TAILFOLLOW); }
+void setTailFollow (bool b) { if (b) page()->flags|=PF_TAILFOLLOW; else page()->flags&=~PF_TAILFOLLOW; }
 optional<string> getDotEditorConfigValue (const string& key, OPT, optional<string> def) {
 IniFile& ini = page()->dotEditorConfig;
 auto it = ini.find(key);
 return it!=ini.end()? it->second : def;
 }
-int addEvent (const string& type, PyGenericFunc cb) {  return page()->AddEvent(type,cb); }
-int removeEvent (const string& type, int id) { return page()->RemoveEvent(type, id); }
+int addEvent (const string& type, PyGenericFunc cb) {
+// Signals are connected on the UI thread, where they are invoked
+shared_ptr<Page> p = page();
+int re = 0;
+Py_BEGIN_ALLOW_THREADS
+RunSync([&]()mutable{ re = p->AddEvent(type,cb); });
+Py_END_ALLOW_THREADS
+return re;
+}
+int removeEvent (const string& type, int id) {
+shared_ptr<Page> p = page();
+int re = 0;
+Py_BEGIN_ALLOW_THREADS
+RunSync([&]()mutable{ re = p->RemoveEvent(type, id); });
+Py_END_ALLOW_THREADS
+return re;
+}
 void addPageGroup (const tstring& name) { page()->AddPageGroup(PageGroup::getGroup(name)); }
 void removePageGroup (const tstring& name) { page()->RemovePageGroup(PageGroup::getGroup(name)); }
 void focus () { page()->Focus(); }
@@ -66,12 +94,99 @@ bool findNext () { bool re; RunSync([&]()mutable{ re = page()->FindNext(); });
 bool findPrev () { bool re; RunSync([&]()mutable{ re = page()->FindPrev(); }); return re; }
 void undo () { RunSync([&]()mutable{ page()->Undo(); }); }
 void redo () { RunSync([&]()mutable{ page()->Redo(); }); }
-void save () { RunSync([&]()mutable{ page()->SaveFile(); }); }
-void reload () { RunSync([&]()mutable{ page()->LoadFile(TEXT(""),false); }); }
+void save (OPT, bool background) { 
+// Saving and loading may need Python, e.g. for some encodings or compressed files
+shared_ptr<Page> p = page();
+Py_BEGIN_ALLOW_THREADS
+RunSync([&]()mutable{ p->SaveFile(TEXT(""), background); }); 
+Py_END_ALLOW_THREADS
+}
+void reload () { 
+shared_ptr<Page> p = page();
+Py_BEGIN_ALLOW_THREADS
+RunSync([&]()mutable{ p->LoadFile(TEXT(""),false); }); 
+Py_END_ALLOW_THREADS
+}
+template<class R> R getStructure (R(*f)(Page&)) {
+// The structure index lives in the UI thread
+shared_ptr<Page> p = page();
+R re;
+Py_BEGIN_ALLOW_THREADS
+RunSync([&]()mutable{ re = f(*p); });
+Py_END_ALLOW_THREADS
+return re;
+}
+vector<int> getParagraphs () { return getStructure(GetParagraphPositions); }
+vector<tuple<int,int>> getBracketBlocks () { return getStructure(GetBracketBlocks); }
+vector<int> getIndentationLevels () { return getStructure(GetIndentationLevels); }
+vector<tuple<int,int>> getBracketPairs () { return getStructure(GetBracketPairs); }
+int getMatchingBracket (int pos) {
+shared_ptr<Page> p = page();
+int re;
+Py_BEGIN_ALLOW_THREADS
+RunSync([&]()mutable{ re = FindMatchingBracket(*p, pos); });
+Py_END_ALLOW_THREADS
+return re;
+}
+any getEnclosingBrackets (int pos) {
+shared_ptr<Page> p = page();
+int start, end;
+bool found;
+Py_BEGIN_ALLOW_THREADS
+RunSync([&]()mutable{ found = FindEnclosingBrackets(*p, pos, start, end); });
+Py_END_ALLOW_THREADS
+if (found) return pair<int,int>(start, end);
+else return any();
+}
 int getTextLength () { return page()->GetTextLength(); }
 tstring getSelectedText () { return page()->GetSelectedText(); }
 void setSelectedText (const tstring& s) { page()->SetSelectedText(s); }
-tstring getText () { return page()->GetText(); }
+shared_ptr<const tstring> getTextSnapshot (unsigned int* generation = NULL) {
+shared_ptr<Page> p = page();
+shared_ptr<const tstring> re;
+Py_BEGIN_ALLOW_THREADS
+RunSync([&]()mutable{
+re = p->GetTextSnapshot();
+if (generation) *generation = p->editGeneration;
+});
+Py_END_ALLOW_THREADS
+return re;
+}
+PySafeObject getText () {
+// Repeated accesses between two edits share the same copy of the text
+shared_ptr<const tstring> text = getTextSnapshot();
+PySafeObject re;
+re.assign(PyUnicode_FromWideChar(text->data(), text->size()), true);
+return re;
+}
+PySafeObject getTextView () {
+unsigned int generation;
+shared_ptr<const tstring> text = getTextSnapshot(&generation);
+PySafeObject re;
+re.assign(CreatePyTextView(page(), text, generation, false), true);
+return re;
+}
+PySafeObject snapshot () {
+unsigned int generation;
+shared_ptr<const tstring> text = getTextSnapshot(&generation);
+PySafeObject re;
+re.assign(CreatePyTextView(page(), text, generation, true), true);
+return re;
+}
+PySafeObject lines () {
+shared_ptr<const tstring> text = getTextSnapshot();
+PySafeObject re;
+re.assign(CreatePyLineIterator(text, 0, text->size()), true);
+return re;
+}
+PySafeObject iterRange (int start, int end) {
+shared_ptr<const tstring> text = getTextSnapshot();
+start = max(0, min<int>(start, text->size()));
+end = max(start, min<int>(end, text->size()));
+PySafeObject re;
+re.assign(CreatePyLineIterator(text, start, end), true);
+return re;
+}
 void setText (const tstring& s) { page()->SetText(s); }
 int getSelectionStart () { return page()->GetSelectionStart(); }
 int getSelectionEnd () { return page()->GetSelectionEnd(); }
@@ -105,6 +220,28 @@ void replaceTextRange (int start, int end, const tstring& str) { page()->Replace
 void deleteTextRange (int start, int end) { replaceTextRange(start, end, TEXT("")); }
 void insertTextAt (int pos, const tstring& str) { replaceTextRange(pos, pos, str); }
 tstring getTextSubstring (int start, int end) { return page()->GetTextSubstring(start,end); }
+PySafeObject applyEdits (PyObject* o) {
+PySafeObject re, seq;
+seq.assign(PySequence_Fast(o, "sequence of (start, end, text) tuples expected"), true);
+if (!seq.o) return re;
+int n = PySequence_Fast_GET_SIZE(seq.o);
+vector<tuple<int,int,tstring>> edits;
+edits.reserve(n);
+for (int i=0; i<n; i++) {
+int start, end;
+PyObject* str;
+if (!PyArg_ParseTuple(PySequence_Fast_GET_ITEM(seq.o, i), "iiU", &start, &end, &str)) return re;
+edits.push_back(make_tuple(start, end, tstring(PyUnicode_AsUnicode(str))));
+}
+shared_ptr<Page> p = page();
+bool ok = true;
+Py_BEGIN_ALLOW_THREADS
+RunSync([&]()mutable{ ok = p->ApplyEdits(edits); });
+Py_END_ALLOW_THREADS
+if (!ok) PyErr_SetString(PyExc_ValueError, "edits overlap or are out of range");
+else re = Py_None;
+return re;
+}
 void pushUndoState (PyObject* o) { page()->PushUndoState(shared_ptr<UndoState>(new PyProxyUndoState(o)), false); }
 };//PyPage class
 
@@ -194,6 +331,7 @@ return -1;
 
 static constexpr const char* PyPage_find_KWLST[] = {"term", "scase", "regex", "up", "stealthty", NULL};
 static constexpr const char* PyPage_searchReplace_KWLST[] = {"search", "replacement", "scase", "regex", "stealthty", NULL};
+static constexpr const char* PyPage_save_KWLST[] = {"background", NULL};
 
 static PyMappingMethods PyPageMapping = {
 PyMapLen, // length
@@ -214,6 +352,16 @@ PyDecl("lineStartOffset", &PyPage::getLineStartIndex),
 PyDecl("lineEndOffset", &PyPage::getLineEndIndex),
 PyDecl("lineSafeStartOffset", &PyPage::getLineSafeStartIndex),
 PyDecl("lineIndentLevel", &PyPage::getLineIndentLevel),
+PyDecl("paragraphs", &PyPage::getParagraphs),
+PyDecl("bracketBlocks", &PyPage::getBracketBlocks),
+PyDecl("indentLevels", &PyPage::getIndentationLevels),
+PyDecl("bracketPairs", &PyPage::getBracketPairs),
+PyDecl("lines", &PyPage::lines),
+PyDecl("applyEdits", &PyPage::applyEdits),
+PyDecl("snapshot", &PyPage::snapshot),
+PyDecl("iterRange", &PyPage::iterRange),
+PyDecl("matchingBracket", &PyPage::getMatchingBracket),
+PyDecl("enclosingBrackets", &PyPage::getEnclosingBrackets),
 PyDecl("columnOfOffset", &PyPage::getColOfPos),
 PyDecl("licol", &PyPage::licol),
 PyDecl("substring", &PyPage::getTextSubstring),
@@ -225,7 +373,7 @@ PyDecl("close", &PyPage::close),
 PyDecl("pushUndoState", &PyPage::pushUndoState),
 PyDecl("undo", &PyPage::undo),
 PyDecl("redo", &PyPage::redo),
-PyDecl("save", &PyPage::save),
+PyDeclKW("save", &PyPage::save, PyPage_save_KWLST),
 PyDecl("reload", &PyPage::reload),
 PyDeclKW("find", &PyPage::find, PyPage_find_KWLST),
 PyDecl("findNext", &PyPage::findNext),
@@ -247,11 +395,16 @@ PyAccessor("encoding", &PyPage::getEncoding, &PyPage::setEncoding),
 PyAccessor("indentation", &PyPage::getIndentationMode, &PyPage::setIndentationMode),
 PyAccessor("tabWidth", &PyPage::getTabWidth, &PyPage::setTabWidth),
 PyAccessor("autoLineBreak", &PyPage::getAutoLineBreak, &PyPage::setAutoLineBreak),
+PyAccessor("trimTrailingWhitespace", &PyPage::getTrimTrailingWhitespace, &PyPage::setTrimTrailingWhitespace),
+PyAccessor("insertFinalNewline", &PyPage::getInsertFinalNewline, &PyPage::setInsertFinalNewline),
+PyAccessor("tail", &PyPage::getTail, &PyPage::setTail),
+PyAccessor("tailFollow", &PyPage::getTailFollow, &PyPage::setTailFollow),
 PyAccessor("selectionStart", &PyPage::getSelectionStart, &PyPage::setSelectionStart),
 PyAccessor("selectionEnd", &PyPage::getSelectionEnd, &PyPage::setSelectionEnd),
 PyAccessor("position", &PyPage::getSelectionEnd, &PyPage::setPosition),
 PyAccessor("selectedText", &PyPage::getSelectedText, &PyPage::setSelectedText),
 PyAccessor("text", &PyPage::getText, &PyPage::setText),
+PyReadOnlyAccessor("textView", &PyPage::getTextView),
 PyAccessor("curLine", &PyPage::getCurLine, &PyPage::setCurLine),
 PyAccessor("curLineText", &PyPage::getCurLineText, &PyPage::setCurLineText),
 PyReadOnlyAccessor("textLength", &PyPage::getTextLength),
@@ -319,6 +472,251 @@ PyObject* arg = p.GetPyData();
 CallMethod<void>(*obj, "redo", arg);
 }
 
+/* Read-only view of a copy of the text of a page, shared with the page until the next edit
+It supports the buffer protocol, exposing the text as UTF-16 code units, so that memoryview and similar consumers don't copy it again
+Snapshots remain usable after the text is modified; since they never touch the page, they can be read from any thread
+*/
+struct PyTextView: PyObjectBase {
+shared_ptr<const tstring> text;
+weak_ptr<Page> page;
+unsigned int generation;
+bool snapshot;
+Py_ssize_t shape;
+
+bool isValid () {
+if (snapshot) return true;
+shared_ptr<Page> p = page.lock();
+return p && p->editGeneration==generation;
+}
+PySafeObject lines () {
+PySafeObject re;
+re.assign(CreatePyLineIterator(text, 0, text->size()), true);
+return re;
+}
+any find (const tstring& term, OPT, int start, bool scase, bool regex) {
+pair<int,int> re;
+start = max(0, min<int>(start, text->size()));
+Py_BEGIN_ALLOW_THREADS
+re = preg_search(*text, term, start, !scase, !regex);
+Py_END_ALLOW_THREADS
+if (re.first<0) return any();
+return re;
+}
+int wordCount () {
+int count = 0;
+Py_BEGIN_ALLOW_THREADS
+bool inWord = false;
+for (TCHAR c: *text) {
+bool w = c>32 && c!=0xA0;
+if (w && !inWord) count++;
+inWord = w;
+}
+Py_END_ALLOW_THREADS
+return count;
+}
+int lineCount () {
+int count = 1;
+Py_BEGIN_ALLOW_THREADS
+count += std::count(text->begin(), text->end(), '\n');
+Py_END_ALLOW_THREADS
+return count;
+}
+};
+
+static constexpr const char* PyTextView_find_KWLST[] = {"term", "start", "scase", "regex", NULL};
+
+static bool PyTextViewCheck (PyTextView& v) {
+if (v.isValid()) return true;
+PyErr_SetString(PyExc_ValueError, "The text has been modified since this view was taken");
+return false;
+}
+
+static void PyTextViewDealloc (PyObject* o) {
+PyTextView* v = (PyTextView*)o;
+v->text.~shared_ptr<const tstring>();
+v->page.~weak_ptr<Page>();
+Py_TYPE(o)->tp_free(o);
+}
+
+static Py_ssize_t PyTextViewLen (PyObject* o) {
+return ((PyTextView*)o)->text->size();
+}
+
+static PyObject* PyTextViewGet (PyObject* o, PyObject* k) {
+PyTextView& v = *(PyTextView*)o;
+if (!PyTextViewCheck(v)) return NULL;
+const tstring& text = *v.text;
+if (PyLong_Check(k)) {
+Py_ssize_t i = PyLong_AsSsize_t(k);
+if (i<0) i += text.size();
+if (i<0 || i>=text.size()) { PyErr_SetString(PyExc_IndexError, "index out of range"); return NULL; }
+return PyUnicode_FromWideChar(text.data()+i, 1);
+}
+else if (PySlice_Check(k)) {
+Py_ssize_t start, end, step, slicelen;
+if (PySlice_GetIndicesEx(k, text.size(), &start, &end, &step, &slicelen)) return NULL;
+if (step!=1) { PyErr_SetString(PyExc_ValueError, "step!=1 isn't supported."); return NULL; }
+return PyUnicode_FromWideChar(text.data()+start, max<Py_ssize_t>(0, end-start));
+}
+PyErr_SetString(PyExc_TypeError, "int or slice expected"); 
+return NULL;
+}
+
+static PyObject* PyTextViewStr (PyObject* o) {
+PyTextView& v = *(PyTextView*)o;
+if (!PyTextViewCheck(v)) return NULL;
+return PyUnicode_FromWideChar(v.text->data(), v.text->size());
+}
+
+static int PyTextViewGetBuffer (PyObject* o, Py_buffer* b, int flags) {
+PyTextView& v = *(PyTextView*)o;
+b->obj = NULL;
+if (flags&PyBUF_WRITABLE) { PyErr_SetString(PyExc_BufferError, "Text views are read-only"); return -1; }
+if (!PyTextViewCheck(v)) return -1;
+b->buf = (void*)v.text->data();
+b->obj = o;
+Py_INCREF(o);
+b->len = v.text->size() * sizeof(TCHAR);
+b->readonly = 1;
+b->itemsize = sizeof(TCHAR);
+b->format = (flags&PyBUF_FORMAT)? (char*)"H" : NULL;
+b->ndim = 1;
+b->shape = (flags&PyBUF_ND)? &v.shape : NULL;
+b->strides = (flags&PyBUF_STRIDES)==PyBUF_STRIDES? &b->itemsize : NULL;
+b->suboffsets = NULL;
+b->internal = NULL;
+return 0;
+}
+
+static PyMappingMethods PyTextViewMapping = {
+PyTextViewLen, PyTextViewGet, NULL
+};
+
+static PyBufferProcs PyTextViewBuffer = {
+PyTextViewGetBuffer, NULL
+};
+
+static PyMethodDef PyTextViewMethods[] = {
+PyDecl("lines", &PyTextView::lines),
+PyDeclKW("find", &PyTextView::find, PyTextView_find_KWLST),
+PyDecl("wordCount", &PyTextView::wordCount),
+PyDecl("lineCount", &PyTextView::lineCount),
+PyDeclEnd
+};
+
+static PyGetSetDef PyTextViewAccessors[] = {
+PyReadOnlyAccessor("valid", &PyTextView::isValid),
+PyDeclEnd
+};
+
+static PyTypeObject PyTextViewType = { 
+    PyVarObject_HEAD_INIT(NULL, 0) 
+    "sixpad.TextView",             /* tp_name */ 
+    sizeof(PyTextView), /* tp_basicsize */ 
+    0,                         /* tp_itemsize */ 
+    PyTextViewDealloc,                         /* tp_dealloc */ 
+    0,                         /* tp_print */ 
+    0,                         /* tp_getattr */ 
+    0,                         /* tp_setattr */ 
+    0,                         /* tp_reserved */ 
+    0,                         /* tp_repr */ 
+    0,                         /* tp_as_number */ 
+    0,                         /* tp_as_sequence */ 
+    &PyTextViewMapping,                         /* tp_as_mapping */ 
+    0,                         /* tp_hash  */ 
+    0,                         /* tp_call */ 
+    PyTextViewStr,                         /* tp_str */ 
+    0,                         /* tp_getattro */ 
+    0,                         /* tp_setattro */ 
+    &PyTextViewBuffer,                         /* tp_as_buffer */ 
+    Py_TPFLAGS_DEFAULT,        /* tp_flags */ 
+    NULL,           /* tp_doc */
+    0,                         /* tp_traverse */ 
+    0,                         /* tp_clear */ 
+    0,                         /* tp_richcompare */ 
+    0,                         /* tp_weaklistoffset */ 
+    0,                         /* tp_iter */ 
+    0,                         /* tp_iternext */ 
+    PyTextViewMethods,             /* tp_methods */ 
+NULL,             /* tp_members */ 
+    PyTextViewAccessors,                         /* tp_getset */ 
+}; 
+
+static PyObject* CreatePyTextView (const shared_ptr<Page>& p, const shared_ptr<const tstring>& text, unsigned int generation, bool snapshot) {
+PyTextView* v = (PyTextView*)(PyTextViewType.tp_alloc(&PyTextViewType, 0));
+if (!v) return NULL;
+new(&v->text) shared_ptr<const tstring>(text);
+new(&v->page) weak_ptr<Page>(p);
+v->generation = generation;
+v->snapshot = snapshot;
+v->shape = text->size();
+return (PyObject*)v;
+}
+
+// Iterates over the lines of a copy of the text, creating a string for each line only
+struct PyLineIterator: PyObjectBase {
+shared_ptr<const tstring> text;
+int pos, end;
+bool done;
+};
+
+static void PyLineIteratorDealloc (PyObject* o) {
+((PyLineIterator*)o)->text.~shared_ptr<const tstring>();
+Py_TYPE(o)->tp_free(o);
+}
+
+static PyObject* PyLineIteratorNext (PyObject* o) {
+PyLineIterator& it = *(PyLineIterator*)o;
+if (it.done) return NULL;
+const TCHAR* s = it.text->data();
+int e = find(s+it.pos, s+it.end, '\n') - s, next = e+1;
+if (e>=it.end) it.done = true;
+else if (e>it.pos && s[e -1]=='\r') e--;
+PyObject* re = PyUnicode_FromWideChar(s+it.pos, e-it.pos);
+it.pos = next;
+return re;
+}
+
+static PyTypeObject PyLineIteratorType = { 
+    PyVarObject_HEAD_INIT(NULL, 0) 
+    "sixpad.LineIterator",             /* tp_name */ 
+    sizeof(PyLineIterator), /* tp_basicsize */ 
+    0,                         /* tp_itemsize */ 
+    PyLineIteratorDealloc,                         /* tp_dealloc */ 
+    0,                         /* tp_print */ 
+    0,                         /* tp_getattr */ 
+    0,                         /* tp_setattr */ 
+    0,                         /* tp_reserved */ 
+    0,                         /* tp_repr */ 
+    0,                         /* tp_as_number */ 
+    0,                         /* tp_as_sequence */ 
+    0,                         /* tp_as_mapping */ 
+    0,                         /* tp_hash  */ 
+    0,                         /* tp_call */ 
+    0,                         /* tp_str */ 
+    0,                         /* tp_getattro */ 
+    0,                         /* tp_setattro */ 
+    0,                         /* tp_as_buffer */ 
+    Py_TPFLAGS_DEFAULT,        /* tp_flags */ 
+    NULL,           /* tp_doc */
+    0,                         /* tp_traverse */ 
+    0,                         /* tp_clear */ 
+    0,                         /* tp_richcompare */ 
+    0,                         /* tp_weaklistoffset */ 
+    PyObject_SelfIter,                         /* tp_iter */ 
+    PyLineIteratorNext,                         /* tp_iternext */ 
+}; 
+
+static PyObject* CreatePyLineIterator (const shared_ptr<const tstring>& text, int start, int end) {
+PyLineIterator* it = (PyLineIterator*)(PyLineIteratorType.tp_alloc(&PyLineIteratorType, 0));
+if (!it) return NULL;
+new(&it->text) shared_ptr<const tstring>(text);
+it->pos = start;
+it->end = end;
+it->done = false;
+return (PyObject*)it;
+}
+
 PyObject* export CreatePyPageObject (shared_ptr<Page> p) {
 GIL_PROTECT
 PyPage* it = PyPageNew(&PyPageType, NULL, NULL);
@@ -334,6 +732,8 @@ return e->page();
 bool export PyRegister_Page (PyObject* m) {
 //PyPageType.tp_new = (decltype(PyPageType.tp_new))PyPageNew;
 if (PyType_Ready(&PyPageType) < 0)          return false;
+if (PyType_Ready(&PyTextViewType) < 0)          return false;
+if (PyType_Ready(&PyLineIteratorType) < 0)          return false;
 Py_INCREF(&PyPageType); 
 PyModule_AddObject(m, "Page", (PyObject*)&PyPageType); 
 return true;
@@ -0,0 +1,241 @@
+#include "RecoveryJournal.h"
+#include "page.h"
+#include "file.h"
+#include "Thread.h"
+#include "sixpad.h"
+#include "BinaryIO.h"
+#include<deque>
+#include<algorithm>
+#include<unordered_map>
+using namespace std;
+
+#define JOURNAL_COALESCE_DELAY 250
+#define JOURNAL_MIN_COMPACTION_SIZE 65536
+
+/* Each journal starts with a snapshot of the page, followed by edits appended as the user types:
+"6PJ1" 'S' file name encoding lineEnding indentationMode tabWidth text
+'E' position deletedLength insertedText
+Integers are 32-bit little endian; strings are prefixed by their length in characters
+*/
+
+struct JournalRecord {
+tstring path;
+char type; // 'S' snapshot, 'E' edits, 'D' delete the journal
+string data;
+tstring text;
+};
+
+struct PageJournal {
+weak_ptr<Page> page;
+tstring path;
+int expectedLength, bytes, snapshotBytes;
+bool dirty, snapshotScheduled;
+};
+
+static CRITICAL_SECTION journalLock;
+static HANDLE journalEvent, journalLockFile = NULL;
+static deque<JournalRecord> journalQueue;
+static bool journalStopping = false;
+static Thread* journalWriter = NULL;
+static unordered_map<Page*, PageJournal> journals; // Only accessed from the UI thread
+static int journalInterval = -1, journalTimer = 0, journalCount = 0;
+static struct JournalInit { JournalInit () { InitializeCriticalSection(&journalLock); journalEvent = CreateEvent(NULL, FALSE, FALSE, NULL); } } journalInit;
+
+static tstring RecoveryDirectory () {
+TCHAR buf[300] = {0};
+GetModuleFileName(NULL, buf, 299);
+tstring dir = buf;
+return dir.substr(0, dir.find_last_of(TEXT("\\/"))) + TEXT("\\recovery");
+}
+
+static void WriteJournalSnapshot (const JournalRecord& r) {
+// Write the new journal aside, so that the old one stays valid if we crash in the middle
+tstring tmp = r.path + TEXT(".tmp");
+{ File fd(tmp, true);
+if (!fd) return;
+fd.writeFully(r.data.data(), r.data.size());
+fd.writeFully(r.text.data(), r.text.size()*sizeof(TCHAR));
+}
+MoveFileEx(tmp.c_str(), r.path.c_str(), MOVEFILE_REPLACE_EXISTING);
+}
+
+static void JournalWriterProc () {
+while(true) {
+WaitForSingleObject(journalEvent, INFINITE);
+deque<JournalRecord> records;
+bool stopping;
+{ SCOPE_LOCK(journalLock);
+stopping = journalStopping;
+}
+if (!stopping) Sleep(JOURNAL_COALESCE_DELAY); // Bursts of typing are written at once
+{ SCOPE_LOCK(journalLock);
+records.swap(journalQueue);
+stopping = journalStopping;
+}
+for (int i=0; i<records.size(); i++) {
+JournalRecord& r = records[i];
+if (r.type=='D') DeleteFile(r.path.c_str());
+else if (r.type=='S') WriteJournalSnapshot(r);
+else {
+string data = r.data;
+while (i+1<records.size() && records[i+1].type=='E' && records[i+1].path==r.path) data += records[++i].data;
+File fd(r.path, true, true);
+if (fd) fd.writeFully(data.data(), data.size());
+}}
+if (stopping) break;
+}}
+
+static void EnqueueJournalRecord (JournalRecord&& r) {
+{ SCOPE_LOCK(journalLock);
+journalQueue.push_back(std::move(r));
+}
+SetEvent(journalEvent);
+}
+
+static void TakeSnapshot (Page* key) {
+auto it = journals.find(key);
+if (it==journals.end()) return;
+PageJournal& j = it->second;
+shared_ptr<Page> p = j.page.lock();
+j.snapshotScheduled = false;
+if (!p || !p->IsModified()) { DiscardJournal(key); return; }
+JournalRecord r = { j.path, 'S', "6PJ1S", p->GetText() };
+PutString(r.data, p->file);
+PutString(r.data, p->name);
+PutInt(r.data, p->encoding);
+PutInt(r.data, p->lineEnding);
+PutInt(r.data, p->indentationMode);
+PutInt(r.data, p->tabWidth);
+PutInt(r.data, r.text.size());
+j.dirty = false;
+j.bytes = 0;
+j.expectedLength = r.text.size();
+j.snapshotBytes = r.data.size() + r.text.size()*sizeof(TCHAR);
+EnqueueJournalRecord(std::move(r));
+}
+
+static void ScheduleSnapshot (Page* key, PageJournal& j) {
+// Taken once the current message has been processed, so that the edit being made is included
+j.dirty = true;
+if (j.snapshotScheduled) return;
+j.snapshotScheduled = true;
+RunAsync([=](){ TakeSnapshot(key); });
+}
+
+static void CheckJournals () {
+vector<Page*> keys;
+for (auto& e: journals) keys.push_back(e.first);
+for (Page* key: keys) {
+PageJournal& j = journals[key];
+shared_ptr<Page> p = j.page.lock();
+if (!p || !p->IsModified()) DiscardJournal(key);
+else if (j.snapshotScheduled) continue;
+// Periodic snapshots also catch changes which didn't go through the undo history
+else if (j.dirty || j.bytes>0 || j.expectedLength!=p->GetTextLength()) TakeSnapshot(key);
+}}
+
+static PageJournal* GetJournal (Page& p) {
+if (journalInterval<0) journalInterval = sp->config->get("recoveryInterval", 30);
+if (journalInterval<=0 || !p.zone || (p.flags&PF_NOSAVE)) return NULL;
+auto it = journals.find(&p);
+if (it!=journals.end()) return &it->second;
+tstring dir = RecoveryDirectory();
+if (!journalWriter) {
+CreateDirectory(dir.c_str(), NULL);
+// Deleted by the system when the process ends, even abnormally; journals without their lock file are orphaned
+journalLockFile = CreateFile((dir + TEXT("\\") + toTString((int)GetCurrentProcessId()) + TEXT(".lock")).c_str(), GENERIC_WRITE, 0, NULL, CREATE_ALWAYS, FILE_ATTRIBUTE_HIDDEN | FILE_FLAG_DELETE_ON_CLOSE, NULL);
+journalWriter = new Thread(JournalWriterProc);
+journalTimer = sp->SetTimeout(CheckJournals, journalInterval*1000, true);
+}
+PageJournal& j = journals[&p];
+j.page = p.shared_from_this();
+j.path = dir + TEXT("\\") + toTString((int)GetCurrentProcessId()) + TEXT("-") + toTString(++journalCount) + TEXT(".6pj");
+j.expectedLength = j.bytes = j.snapshotBytes = 0;
+j.dirty = j.snapshotScheduled = false;
+ScheduleSnapshot(&p, j);
+return &j;
+}
+
+void export JournalEdit (Page& p, int pos, int deleted, const tstring& inserted) {
+PageJournal* j = GetJournal(p);
+if (!j || j->dirty) return; // The pending snapshot will include this edit
+if (pos<0 || deleted<0) { ScheduleSnapshot(&p, *j); return; }
+JournalRecord r = { j->path, 'E', "E", TEXT("") };
+PutInt(r.data, pos);
+PutInt(r.data, deleted);
+PutString(r.data, inserted);
+j->expectedLength += inserted.size() - deleted;
+j->bytes += r.data.size();
+EnqueueJournalRecord(std::move(r));
+// Compaction: replace the journal by a fresh snapshot once the edits outweigh it
+if (j->bytes>max(JOURNAL_MIN_COMPACTION_SIZE, j->snapshotBytes)) ScheduleSnapshot(&p, *j);
+}
+
+void export JournalTextChanged (Page& p) {
+if (!journals.count(&p) && !p.IsModified()) return; // Loading a file, nothing to recover
+PageJournal* j = GetJournal(p);
+if (j) ScheduleSnapshot(&p, *j);
+}
+
+void export DiscardJournal (Page* p) {
+auto it = journals.find(p);
+if (it==journals.end()) return;
+EnqueueJournalRecord({ it->second.path, 'D', "", TEXT("") });
+journals.erase(it);
+}
+
+void export CloseRecoveryJournals () {
+if (!journalWriter) return;
+while (journals.size()>0) DiscardJournal(journals.begin()->first);
+if (journalTimer) sp->ClearTimeout(journalTimer);
+journalTimer = 0;
+{ SCOPE_LOCK(journalLock);
+journalStopping = true;
+}
+SetEvent(journalEvent);
+journalWriter->join(5000);
+if (journalLockFile && journalLockFile!=INVALID_HANDLE_VALUE) CloseHandle(journalLockFile);
+journalLockFile = NULL;
+}
+
+static bool ReadJournal (const string& data, RecoveredPage& r) {
+const char *p = data.data(), *end = p + data.size();
+if (data.size()<5 || data.compare(0, 5, "6PJ1S")) return false;
+p+=5;
+if (!GetString(p, end, r.file) || !GetString(p, end, r.name) || !GetInt(p, end, r.encoding) || !GetInt(p, end, r.lineEnding) || !GetInt(p, end, r.indentationMode) || !GetInt(p, end, r.tabWidth) || !GetString(p, end, r.text)) return false;
+// A truncated last edit, written while crashing, is ignored
+while (p<end && *p=='E') {
+const char* q = p+1;
+int pos, deleted;
+tstring inserted;
+if (!GetInt(q, end, pos) || !GetInt(q, end, deleted) || !GetString(q, end, inserted) || pos<0 || deleted<0 || pos+deleted>r.text.size()) break;
+r.text.replace(pos, deleted, inserted);
+p = q;
+}
+return true;
+}
+
+vector<RecoveredPage> export FindRecoveryJournals () {
+vector<RecoveredPage> pages;
+tstring dir = RecoveryDirectory();
+WIN32_FIND_DATA fd;
+HANDLE hf = FindFirstFile((dir + TEXT("\\*.6pj*")).c_str(), &fd);
+if (hf==INVALID_HANDLE_VALUE) return pages;
+vector<tstring> files;
+do {
+tstring name = fd.cFileName;
+tstring lock = dir + TEXT("\\") + name.substr(0, name.find('-')) + TEXT(".lock");
+if (GetFileAttributes(lock.c_str())==INVALID_FILE_ATTRIBUTES) files.push_back(dir + TEXT("\\") + name);
+} while (FindNextFile(hf, &fd));
+FindClose(hf);
+sort(files.begin(), files.end());
+for (auto& file: files) {
+if (!ends_with(file, TEXT(".tmp"))) {
+File f(file);
+RecoveredPage r;
+if (f && ReadJournal(f.readFully(), r)) pages.push_back(r);
+}
+DeleteFile(file.c_str());
+}
+return pages;
+}
@@ -0,0 +1,22 @@
+#ifndef ___RECOVERYJOURNAL_H9
+#define ___RECOVERYJOURNAL_H9
+#include "global.h"
+#include<vector>
+
+struct Page;
+
+struct RecoveredPage {
+tstring file, name, text;
+int encoding, lineEnding, indentationMode, tabWidth;
+};
+
+// Edits of modified pages are journaled in the recovery directory on a background thread, so that they can be recovered if 6pad++ doesn't exit normally
+void export JournalEdit (Page& page, int pos, int deleted, const tstring& inserted);
+// The text has been changed without any corresponding edit, a new snapshot has to be taken
+void export JournalTextChanged (Page& page);
+void export DiscardJournal (Page* page);
+void export CloseRecoveryJournals ();
+// Journals left by instances which didn't exit normally; they are removed from the disk once read
+std::vector<RecoveredPage> export FindRecoveryJournals ();
+
+#endif
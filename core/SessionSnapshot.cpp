@@ -0,0 +1,222 @@
+#include "SessionSnapshot.h"
+#include "page.h"
+#include "file.h"
+#include "Thread.h"
+#include "TaskScheduler.h"
+#include "sixpad.h"
+#include "BinaryIO.h"
+#include<unordered_map>
+#include<algorithm>
+using namespace std;
+
+/* The session file keeps the state of the pages open, so that the next instance can restore them without guessing their format again:
+"6PS1" count, then for each page: file lastModified size hash encoding lineEnding indentationMode tabWidth selectionStart selectionEnd firstVisibleLine
+lastModified, size and hash are 64-bit, other integers 32-bit, all little endian; strings are prefixed by their length in characters
+It is rewritten in the background at regular intervals if anything has changed; only files modified since they were last hashed are read again
+*/
+
+struct FileDigest {
+unsigned long long lastModified, size, hash;
+};
+
+static CRITICAL_SECTION sessionLock;
+static tstring sessionFileName;
+static function<vector<shared_ptr<Page>>()> sessionPages;
+static vector<SessionEntry> sessionEntries; // Last entries taken, only accessed from the UI thread
+static vector<SessionEntry> pendingEntries;
+static bool sessionWriting = false, sessionPending = false;
+static Task sessionTask;
+static int sessionTimer = 0;
+// Only accessed by the task writing the session, of which there is never more than one
+static unordered_map<tstring, FileDigest> digests;
+static string lastWritten;
+static struct SessionInit { SessionInit () { InitializeCriticalSection(&sessionLock); } } sessionInit;
+
+// FNV-1a
+static unsigned long long HashData (const char* data, size_t len) {
+unsigned long long h = 14695981039346656037ULL;
+for (size_t i=0; i<len; i++) {
+h ^= (unsigned char)data[i];
+h *= 1099511628211ULL;
+}
+return h;
+}
+
+static bool GetFileState (const tstring& file, unsigned long long& lastModified, unsigned long long& size) {
+WIN32_FILE_ATTRIBUTE_DATA fa;
+if (!GetFileAttributesEx(file.c_str(), GetFileExInfoStandard, &fa)) return false;
+lastModified = ((unsigned long long)fa.ftLastWriteTime.dwHighDateTime<<32) | fa.ftLastWriteTime.dwLowDateTime;
+size = ((unsigned long long)fa.nFileSizeHigh<<32) | fa.nFileSizeLow;
+return true;
+}
+
+static bool GetFileDigest (const tstring& file, FileDigest& d) {
+if (!GetFileState(file, d.lastModified, d.size)) return false;
+auto it = digests.find(file);
+if (it!=digests.end() && it->second.lastModified==d.lastModified && it->second.size==d.size) {
+d.hash = it->second.hash;
+return true;
+}
+File fd(file);
+if (!fd) return false;
+boost::string_ref data = fd.view();
+string str;
+if (data.size()<=0) data = str = fd.readFully();
+if (data.size()!=d.size) return false; // Modified while we were reading it
+d.hash = HashData(data.data(), data.size());
+digests[file] = d;
+return true;
+}
+
+static string SerializeSession (const vector<SessionEntry>& entries) {
+string s = "6PS1";
+PutInt(s, entries.size());
+for (const SessionEntry& e: entries) {
+PutString(s, e.file);
+PutInt64(s, e.lastModified);
+PutInt64(s, e.size);
+PutInt64(s, e.hash);
+PutInt(s, e.encoding);
+PutInt(s, e.lineEnding);
+PutInt(s, e.indentationMode);
+PutInt(s, e.tabWidth);
+PutInt(s, e.selectionStart);
+PutInt(s, e.selectionEnd);
+PutInt(s, e.firstVisibleLine);
+}
+return s;
+}
+
+static bool ParseSession (const string& data, vector<SessionEntry>& entries) {
+const char *p = data.data(), *end = p + data.size();
+int count;
+if (data.size()<4 || data.compare(0, 4, "6PS1")) return false;
+p+=4;
+if (!GetInt(p, end, count) || count<0) return false;
+for (int i=0; i<count; i++) {
+SessionEntry e;
+if (!GetString(p, end, e.file) || !GetInt64(p, end, e.lastModified) || !GetInt64(p, end, e.size) || !GetInt64(p, end, e.hash)
+|| !GetInt(p, end, e.encoding) || !GetInt(p, end, e.lineEnding) || !GetInt(p, end, e.indentationMode) || !GetInt(p, end, e.tabWidth)
+|| !GetInt(p, end, e.selectionStart) || !GetInt(p, end, e.selectionEnd) || !GetInt(p, end, e.firstVisibleLine)) return false;
+e.synchronized = e.lastModified>0;
+entries.push_back(e);
+}
+return true;
+}
+
+static void WriteSession (vector<SessionEntry>& entries) {
+for (SessionEntry& e: entries) {
+FileDigest d = { 0, 0, 0 };
+if (e.synchronized && !GetFileDigest(e.file, d)) d = { 0, 0, 0 };
+e.lastModified = d.lastModified;
+e.size = d.size;
+e.hash = d.hash;
+}
+string data = SerializeSession(entries);
+if (data==lastWritten) return;
+// Written aside, so that the previous session stays valid if we crash in the middle
+tstring tmp = sessionFileName + TEXT(".tmp");
+{ File fd(tmp, true);
+if (!fd || !fd.writeFully(data.data(), data.size())) return;
+}
+if (MoveFileEx(tmp.c_str(), sessionFileName.c_str(), MOVEFILE_REPLACE_EXISTING)) lastWritten = data;
+}
+
+static void SessionWriterProc () {
+while(true) {
+vector<SessionEntry> entries;
+{ SCOPE_LOCK(sessionLock);
+if (!sessionPending) {
+sessionWriting = false;
+return;
+}
+entries.swap(pendingEntries);
+sessionPending = false;
+}
+WriteSession(entries);
+}}
+
+static void UpdateSessionSnapshot () {
+if (sessionFileName.empty() || !sessionPages) return;
+vector<SessionEntry> entries;
+for (shared_ptr<Page>& p: sessionPages()) {
+if ((p->flags&PF_NOSAVE) || p->file.size()<=0) continue;
+// A page still loading keeps the state it had in the last session
+auto it = find_if(sessionEntries.begin(), sessionEntries.end(), [&](const SessionEntry& e){ return e.file==p->file; });
+if ((p->flags&PF_LOADING) && it!=sessionEntries.end()) entries.push_back(*it);
+else if (!(p->flags&PF_LOADING)) entries.push_back(TakeSessionEntry(*p));
+}
+sessionEntries = entries;
+SCOPE_LOCK(sessionLock);
+pendingEntries.swap(entries);
+sessionPending = true;
+if (sessionWriting) return;
+sessionWriting = true;
+sessionTask = SubmitTask(SessionWriterProc, TASK_LOW);
+}
+
+vector<SessionEntry> export OpenSessionSnapshot (const tstring& file, const function<vector<shared_ptr<Page>>()>& getPages) {
+int interval = sp->config->get("sessionSnapshotInterval", 15);
+if (interval<=0 || file.empty()) return sessionEntries;
+sessionFileName = file;
+sessionPages = getPages;
+File fd(file);
+if (fd) {
+string data = fd.readFully();
+lastWritten = data;
+if (!ParseSession(data, sessionEntries)) sessionEntries.clear();
+}
+sessionTimer = sp->SetTimeout(UpdateSessionSnapshot, interval*1000, true);
+return sessionEntries;
+}
+
+void export FlushSessionSnapshot () {
+if (sessionFileName.empty()) return;
+UpdateSessionSnapshot();
+Task task;
+{ SCOPE_LOCK(sessionLock);
+task = sessionTask;
+}
+if (task) task.Wait(5000);
+}
+
+void export CloseSessionSnapshot () {
+if (sessionFileName.empty()) return;
+if (sessionTimer) sp->ClearTimeout(sessionTimer);
+sessionTimer = 0;
+Task task;
+{ SCOPE_LOCK(sessionLock);
+task = sessionTask;
+}
+if (task) task.Wait(5000);
+sessionPages = nullptr;
+}
+
+SessionEntry export TakeSessionEntry (Page& p) {
+SessionEntry e;
+e.file = p.file;
+e.encoding = p.encoding;
+e.lineEnding = p.lineEnding;
+e.indentationMode = p.indentationMode;
+e.tabWidth = p.tabWidth;
+if (p.zone) {
+p.GetSelection(e.selectionStart, e.selectionEnd);
+e.firstVisibleLine = SendMessage(p.zone, EM_GETFIRSTVISIBLELINE, 0, 0);
+}
+e.synchronized = !p.IsModified() && !(p.flags&(PF_CHANGEDONDISK | PF_TAIL));
+return e;
+}
+
+void export RestoreSessionEntry (Page& p, const SessionEntry& e) {
+int len = p.GetTextLength();
+if (!p.zone || e.selectionStart<0 || e.selectionEnd<0 || e.selectionStart>len || e.selectionEnd>len) return;
+p.SetSelection(e.selectionStart, e.selectionEnd);
+SendMessage(p.zone, EM_LINESCROLL, 0, e.firstVisibleLine - SendMessage(p.zone, EM_GETFIRSTVISIBLELINE, 0, 0));
+}
+
+bool export MatchesSessionEntry (const SessionEntry& e, const tstring& file, const char* data, size_t len) {
+if (!e.synchronized || e.size!=len || e.encoding<0 || e.lineEnding<0 || e.indentationMode<0 || e.tabWidth<=0) return false;
+unsigned long long lastModified, size;
+if (!GetFileState(file, lastModified, size) || lastModified!=e.lastModified || size!=e.size) return false;
+return HashData(data, len)==e.hash;
+}
@@ -0,0 +1,28 @@
+#ifndef ___SESSIONSNAPSHOT_H9
+#define ___SESSIONSNAPSHOT_H9
+#include "global.h"
+#include<vector>
+#include<functional>
+
+struct Page;
+
+struct SessionEntry {
+tstring file;
+unsigned long long lastModified = 0, size = 0, hash = 0; // State of the file on disk, all 0 if the page didn't have its content
+int encoding = -1, lineEnding = -1, indentationMode = -1, tabWidth = -2;
+int selectionStart = 0, selectionEnd = 0, firstVisibleLine = 0;
+bool synchronized = false; // Whether the page had the content of the file when the entry was taken
+};
+
+// Reads the session left by the last instance from the given file, then keeps it up to date with the pages returned by getPages; it is written in the background
+std::vector<SessionEntry> export OpenSessionSnapshot (const tstring& file, const std::function<std::vector<shared_ptr<Page>>()>& getPages);
+// Writes the current state of the pages and waits until it is on the disk
+void export FlushSessionSnapshot ();
+void export CloseSessionSnapshot ();
+SessionEntry export TakeSessionEntry (Page& page);
+// Restores the selection and scrolling of the page, if its text is still long enough
+void export RestoreSessionEntry (Page& page, const SessionEntry& e);
+// Whether the file still has the data the entry was taken from, in which case its format doesn't need to be guessed again; may be called from any thread
+bool export MatchesSessionEntry (const SessionEntry& e, const tstring& file, const char* data, size_t len);
+
+#endif
@@ -0,0 +1,117 @@
+#include "StartupProfile.h"
+#include "Thread.h"
+#include "File.h"
+#include "strings.hpp"
+#include<algorithm>
+using namespace std;
+
+#define STARTUP_PARTS 2
+
+struct ProfiledSpan {
+string name;
+tstring detail;
+DWORD thread;
+long long start, end; // end is -1 while the span is running
+};
+
+static vector<ProfiledSpan> spans;
+static tstring traceFileName;
+static long long origin = 0, frequency = 1;
+static int partsDone = 0;
+static bool profiling = false;
+static CRITICAL_SECTION cs;
+static struct StartupProfileInit { StartupProfileInit () { InitializeCriticalSection(&cs); } } startupProfileInit;
+
+static inline long long Now () {
+LARGE_INTEGER li;
+QueryPerformanceCounter(&li);
+return li.QuadPart;
+}
+
+static inline double ToMicroseconds (long long t) {
+return (t - origin) * 1000000.0 / frequency;
+}
+
+static string JsonQuote (const string& s) {
+string re = "\"";
+for (unsigned char c: s) {
+if (c=='"' || c=='\\') { re += '\\'; re += c; }
+else if (c<32) re += snsprintf(8, "\\u%04x", c);
+else re += c;
+}
+return re + "\"";
+}
+
+static void WriteTrace (const vector<ProfiledSpan>& list) {
+File f(traceFileName, true);
+if (!f) return;
+DWORD pid = GetCurrentProcessId();
+f << "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[\n";
+vector<DWORD> threads;
+for (const ProfiledSpan& s: list) if (find(threads.begin(), threads.end(), s.thread)==threads.end()) threads.push_back(s.thread);
+for (DWORD tid: threads) f << snsprintf(256, "{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":%lu,\"tid\":%lu,\"args\":{\"name\":\"%s\"}},\n", pid, tid, tid==sp->uiThreadId? "UI" : "Python");
+for (int i=0; i<list.size(); i++) {
+const ProfiledSpan& s = list[i];
+f << snsprintf(512 + s.name.size(), "{\"name\":%s,\"cat\":\"startup\",\"ph\":\"X\",\"pid\":%lu,\"tid\":%lu,\"ts\":%.1f,\"dur\":%.1f", JsonQuote(s.name).c_str(), pid, s.thread, ToMicroseconds(s.start), ToMicroseconds(s.end) - ToMicroseconds(s.start));
+if (!s.detail.empty()) f << ",\"args\":{\"detail\":" << JsonQuote(toString(s.detail)) << "}";
+f << (i+1<list.size()? "},\n" : "}\n");
+}
+f << "]}\n";
+}
+
+void export StartupProfileBegin () {
+LARGE_INTEGER li;
+QueryPerformanceFrequency(&li);
+SCOPE_LOCK(cs);
+frequency = li.QuadPart;
+origin = Now();
+profiling = true;
+}
+
+void export SetStartupTraceFile (const tstring& traceFile) {
+SCOPE_LOCK(cs);
+traceFileName = traceFile;
+}
+
+int export StartupSpanBegin (const char* name, const tstring& detail) {
+long long now = Now();
+SCOPE_LOCK(cs);
+if (!profiling) return -1;
+spans.push_back({ name, detail, GetCurrentThreadId(), now, -1 });
+return spans.size() -1;
+}
+
+void export StartupSpanEnd (int span) {
+long long now = Now();
+SCOPE_LOCK(cs);
+if (span>=0 && span<spans.size()) spans[span].end = now;
+}
+
+void export StartupPartDone () {
+vector<ProfiledSpan> list;
+{
+long long now = Now();
+SCOPE_LOCK(cs);
+if (!profiling || ++partsDone<STARTUP_PARTS) return;
+// Spans begun from now on, i.e. by extensions loaded later on, aren't part of the startup
+profiling = false;
+spans.push_back({ "startup", tstring(), GetCurrentThreadId(), origin, now });
+if (traceFileName.empty()) return;
+list = spans;
+}
+// Spans still running, if any, are left out
+list.erase(remove_if(list.begin(), list.end(), [](const ProfiledSpan& s){ return s.end<0; }), list.end());
+stable_sort(list.begin(), list.end(), [](const ProfiledSpan& a, const ProfiledSpan& b){ return a.start<b.start; });
+WriteTrace(list);
+}
+
+vector<tuple<string, tstring, int, double, double>> export GetStartupProfile () {
+vector<tuple<string, tstring, int, double, double>> re;
+SCOPE_LOCK(cs);
+for (const ProfiledSpan& s: spans) {
+if (s.end<0) continue;
+re.push_back(make_tuple(s.name, s.detail, (int)s.thread, ToMicroseconds(s.start) / 1000, (ToMicroseconds(s.end) - ToMicroseconds(s.start)) / 1000));
+}
+stable_sort(re.begin(), re.end(), [](const tuple<string, tstring, int, double, double>& a, const tuple<string, tstring, int, double, double>& b){ return get<3>(a)<get<3>(b); });
+return re;
+}
@@ -0,0 +1,28 @@
+#ifndef ___STARTUPPROFILE_H9
+#define ___STARTUPPROFILE_H9
+#include "global.h"
+#include<vector>
+#include<tuple>
+
+/* Timeline of the startup of the application, made of the spans recorded by the UI and Python threads while it runs
+Startup is complete once the UI thread has painted the window and the Python thread has loaded extensions and scripts
+The timeline is then written in the Chrome trace format, which chrome://tracing and most profilers can open, if a file has been given
+*/
+void export StartupProfileBegin ();
+void export SetStartupTraceFile (const tstring& traceFile);
+int export StartupSpanBegin (const char* name, const tstring& detail);
+void export StartupSpanEnd (int span);
+// Called once by the UI thread and once by the Python thread
+void export StartupPartDone ();
+// Name, detail, thread id, start and duration in milliseconds of each span, sorted by start; a span named startup covers the whole startup once it is complete
+std::vector<std::tuple<std::string, tstring, int, double, double>> export GetStartupProfile ();
+
+struct StartupSpan {
+int span;
+inline StartupSpan (const char* name, const tstring& detail = TEXT("")): span(StartupSpanBegin(name, detail)) {}
+inline ~StartupSpan () { StartupSpanEnd(span); }
+StartupSpan (const StartupSpan&) = delete;
+StartupSpan& operator= (const StartupSpan&) = delete;
+};
+
+#endif
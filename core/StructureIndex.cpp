@@ -0,0 +1,239 @@
+#include "StructureIndex.h"
+#include "page.h"
+#include<algorithm>
+#include<unordered_map>
+#include<climits>
+using namespace std;
+
+struct StructureIndex {
+unsigned int generation = 0; // Edit generation of the page the index corresponds to
+int length = 0, dirtyFrom = -1; // First position modified since the index was built, -1 if it is up to date
+bool built = false;
+vector<int> starts, ends, firsts, indents; // For each line: start, end without the line break, first non-blank character or -1, number of indentation characters
+vector<int> shared; // Number of indentation characters each line has in common with the previous one, -1 for the first line
+vector<int> blankLines, filledLines;
+vector<int> openings, closings; // '{' and '}' directly followed by a line break
+vector<int> minShared; // Segment tree giving the minimum of shared over ranges of lines
+int treeSize = 0;
+};
+
+static unordered_map<Page*, StructureIndex> structureIndexes; // Only accessed from the UI thread
+
+static inline bool IsIndentChar (TCHAR c) { return c=='\t' || c==' ' || c==(TCHAR)0xA0; }
+static inline bool IsLineBreak (TCHAR c) { return c=='\r' || c=='\n'; }
+
+template<class T> static inline void EraseFrom (vector<T>& v, const T& x) {
+v.erase(lower_bound(v.begin(), v.end(), x), v.end());
+}
+
+static void ScanLines (StructureIndex& s, const TCHAR* text, int len, int line) {
+int i = line<s.starts.size()? s.starts[line] : 0;
+s.starts.resize(line);
+s.ends.resize(line);
+s.firsts.resize(line);
+s.indents.resize(line);
+s.shared.resize(line);
+EraseFrom(s.blankLines, line);
+EraseFrom(s.filledLines, line);
+EraseFrom(s.openings, i);
+EraseFrom(s.closings, i);
+while(true) {
+int start = i, first = -1, indent = 0;
+for (bool indenting=true; i<len && text[i]!='\n'; i++) {
+TCHAR c = text[i];
+if (indenting && IsIndentChar(c)) indent++;
+else indenting = false;
+if (c>32 && first<0) first = i;
+if ((c=='{' || c=='}') && i+1<len && IsLineBreak(text[i+1])) (c=='{'? s.openings : s.closings) .push_back(i);
+}
+(first<0? s.blankLines : s.filledLines) .push_back(s.starts.size());
+s.starts.push_back(start);
+s.ends.push_back(i<len && i>start && text[i -1]=='\r'? i -1 : i);
+s.firsts.push_back(first);
+s.indents.push_back(indent);
+int n = s.indents.size(), common = -1;
+if (n>1) for (common=0; common<indent && common<s.indents[n -2] && text[start+common]==text[s.starts[n -2]+common]; ) common++;
+s.shared.push_back(common);
+if (i>=len) break;
+i++;
+}}
+
+static void BuildTree (StructureIndex& s, int from, int oldCount) {
+int n = s.shared.size();
+vector<int>& t = s.minShared;
+if (from<=0 || s.treeSize<n) {
+for (s.treeSize=1; s.treeSize<n; s.treeSize*=2);
+t.assign(2*s.treeSize, INT_MAX);
+copy(s.shared.begin(), s.shared.end(), t.begin() + s.treeSize);
+for (int i=s.treeSize -1; i>0; i--) t[i] = min(t[2*i], t[2*i+1]);
+return;
+}
+// Only update the leaves of the rescanned lines and their ancestors
+int last = max(n, oldCount) -1;
+for (int i=from; i<=last; i++) t[s.treeSize+i] = i<n? s.shared[i] : INT_MAX;
+for (int lo=(s.treeSize+from)/2, hi=(s.treeSize+last)/2; lo>0; lo/=2, hi/=2) {
+for (int i=lo; i<=hi; i++) t[i] = min(t[2*i], t[2*i+1]);
+}}
+
+static inline int LineOf (const StructureIndex& s, int pos) {
+return max(0, (int)(upper_bound(s.starts.begin(), s.starts.end(), pos) - s.starts.begin()) -1);
+}
+
+static StructureIndex& GetIndex (Page& p) {
+StructureIndex& s = structureIndexes[&p];
+int from, len = p.GetTextLength();
+if (!s.built || s.generation!=p.editGeneration) from = 0;
+else if (s.dirtyFrom>=0) from = LineOf(s, s.dirtyFrom);
+else return s;
+int oldCount = s.shared.size();
+HLOCAL hLoc = (HLOCAL)SendMessage(p.zone, EM_GETHANDLE, 0, 0);
+LPCTSTR text = (LPCTSTR)LocalLock(hLoc);
+ScanLines(s, text, len, from);
+LocalUnlock(hLoc);
+BuildTree(s, from, oldCount);
+s.built = true;
+s.generation = p.editGeneration;
+s.length = len;
+s.dirtyFrom = -1;
+return s;
+}
+
+/* Lines belong to the same indented block as long as they start with the indentation of the line where the search began
+Since this holds as long as consecutive lines share that many indentation characters, the boundaries are found by searching the segment tree
+*/
+// First line at or after the given one sharing less than indent characters with its previous line, -1 if there is none
+static int FindBlockBoundaryForward (const StructureIndex& s, int line, int indent) {
+if (line>=s.shared.size()) return -1;
+const vector<int>& t = s.minShared;
+int x = s.treeSize + line;
+while (t[x]>=indent) {
+while (x&1) x/=2;
+if (!x) return -1;
+x++;
+}
+while (x<s.treeSize) {
+x*=2;
+if (t[x]>=indent) x++;
+}
+return x - s.treeSize;
+}
+
+// Last line at or before the given one sharing less than indent characters with its previous line, -1 if there is none
+static int FindBlockBoundaryBackward (const StructureIndex& s, int line, int indent) {
+if (line<0) return -1;
+const vector<int>& t = s.minShared;
+int x = s.treeSize + line;
+while (t[x]>=indent) {
+while (x>1 && !(x&1)) x/=2;
+if (x<=1) return -1;
+x--;
+}
+while (x<s.treeSize) {
+x = 2*x+1;
+if (t[x]>=indent) x--;
+}
+return x - s.treeSize;
+}
+
+int export GetNextParagraphPosition (Page& p, int pos) {
+StructureIndex& s = GetIndex(p);
+int line = LineOf(s, pos);
+// The paragraph ends with the next blank line, the following one starts at the next non-blank line
+auto blank = upper_bound(s.blankLines.begin(), s.blankLines.end(), line);
+if (blank==s.blankLines.end() || *blank>=s.starts.size() -1) return s.length;
+auto next = upper_bound(s.filledLines.begin(), s.filledLines.end(), *blank);
+return next==s.filledLines.end()? s.starts.back() : s.starts[*next];
+}
+
+int export GetPreviousParagraphPosition (Page& p, int pos) {
+StructureIndex& s = GetIndex(p);
+int line = LineOf(s, pos);
+// Start of the paragraph containing the last non-blank character before pos
+if (s.firsts[line]<0 || s.firsts[line]>=pos) {
+auto filled = lower_bound(s.filledLines.begin(), s.filledLines.end(), line);
+if (filled==s.filledLines.begin()) return pos;
+line = *--filled;
+}
+auto blank = lower_bound(s.blankLines.begin(), s.blankLines.end(), line);
+line = blank==s.blankLines.begin()? s.filledLines[0] : *--blank +1;
+return s.firsts[line];
+}
+
+int export GetNextBracketPosition (Page& p, int pos) {
+StructureIndex& s = GetIndex(p);
+auto it = lower_bound(s.closings.begin(), s.closings.end(), pos+1);
+return it==s.closings.end()? s.length : *it +1;
+}
+
+int export GetPreviousBracketPosition (Page& p, int pos) {
+StructureIndex& s = GetIndex(p);
+auto it = lower_bound(s.openings.begin(), s.openings.end(), pos);
+return it==s.openings.begin()? 0 : *--it;
+}
+
+int export GetIndentedBlockEnd (Page& p, int pos) {
+StructureIndex& s = GetIndex(p);
+int line = LineOf(s, pos), count = s.starts.size();
+int next = FindBlockBoundaryForward(s, line+1, s.indents[line]);
+int end = s.ends[next<0? count -1 : next -1];
+// Already at the end of the block: go to the end of the next one
+if (pos==end && line+1<count) return GetIndentedBlockEnd(p, s.starts[line+1]);
+return end;
+}
+
+int export GetIndentedBlockStart (Page& p, int pos) {
+StructureIndex& s = GetIndex(p);
+int line = LineOf(s, pos), indent = s.indents[line];
+int prev = FindBlockBoundaryBackward(s, line, indent) -1, start = s.starts[prev+1];
+// Already at the start of the block: go to the start of the previous one
+if (prev>=0 && pos>=start && pos<=start+indent) return GetIndentedBlockStart(p, s.ends[prev]);
+return start;
+}
+
+vector<int> export GetParagraphPositions (Page& p) {
+StructureIndex& s = GetIndex(p);
+vector<int> re;
+for (int i=0; i<s.filledLines.size(); i++) {
+int line = s.filledLines[i];
+if (i==0 || s.filledLines[i -1]!=line -1) re.push_back(s.starts[line]);
+}
+return re;
+}
+
+vector<tuple<int,int>> export GetBracketBlocks (Page& p) {
+StructureIndex& s = GetIndex(p);
+vector<tuple<int,int>> re;
+vector<int> open;
+for (int i=0, j=0; j<s.closings.size(); ) {
+if (i<s.openings.size() && s.openings[i]<s.closings[j]) {
+open.push_back(re.size());
+re.push_back(make_tuple(s.openings[i++], -1));
+}
+else {
+if (!open.empty()) { get<1>(re[open.back()]) = s.closings[j]; open.pop_back(); }
+j++;
+}}
+re.erase(remove_if(re.begin(), re.end(), [](const tuple<int,int>& b){ return get<1>(b)<0; }), re.end());
+return re;
+}
+
+vector<int> export GetIndentationLevels (Page& p) {
+StructureIndex& s = GetIndex(p);
+vector<int> re(s.indents.size());
+for (int i=0; i<re.size(); i++) re[i] = s.indents[i] / max(1, p.indentationMode);
+return re;
+}
+
+void export InvalidateStructureIndex (Page& p, int pos) {
+auto it = structureIndexes.find(&p);
+if (it==structureIndexes.end()) return;
+StructureIndex& s = it->second;
+// If other edits were made meanwhile, the generation mismatch already requires a full rebuild
+if (s.generation!=p.editGeneration && s.generation+1!=p.editGeneration) return;
+s.generation = p.editGeneration;
+s.dirtyFrom = s.dirtyFrom<0? pos : min(s.dirtyFrom, pos);
+}
+
+void export DiscardStructureIndex (Page* p) {
+structureIndexes.erase(p);
+}
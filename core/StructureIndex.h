@@ -0,0 +1,28 @@
+#ifndef ___STRUCTUREINDEX_H9
+#define ___STRUCTUREINDEX_H9
+#include "global.h"
+#include<vector>
+#include<tuple>
+
+struct Page;
+
+/* Paragraphs, brackets ending lines and indentation of each line of a page, used to move by paragraph, bracket or indented block
+The index is built on first use and, after edits, rebuilt from the first modified line only; it must only be used from the UI thread
+*/
+int export GetNextParagraphPosition (Page& page, int pos);
+int export GetPreviousParagraphPosition (Page& page, int pos);
+int export GetNextBracketPosition (Page& page, int pos);
+int export GetPreviousBracketPosition (Page& page, int pos);
+int export GetIndentedBlockEnd (Page& page, int pos);
+int export GetIndentedBlockStart (Page& page, int pos);
+// Positions where paragraphs start
+std::vector<int> export GetParagraphPositions (Page& page);
+// Positions of matching '{' and '}' ending lines
+std::vector<std::tuple<int,int>> export GetBracketBlocks (Page& page);
+// Indentation level of each line, as separated by line breaks
+std::vector<int> export GetIndentationLevels (Page& page);
+// The text has been modified from the given position on; called once the edit control has applied the modification and editGeneration has been incremented
+void export InvalidateStructureIndex (Page& page, int pos);
+void export DiscardStructureIndex (Page* page);
+
+#endif
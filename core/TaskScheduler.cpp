@@ -0,0 +1,287 @@
+#include "TaskScheduler.h"
+#include<atomic>
+#include<deque>
+#include<vector>
+#include<algorithm>
+#include<chrono>
+using namespace std;
+
+/* Synchronization primitives: Win32 ones in the application, standard ones elsewhere so that the scheduler can be built and tested on its own
+*/
+#ifdef _WIN32
+#include "Thread.h"
+
+struct SchedulerMutex {
+CRITICAL_SECTION cs;
+SchedulerMutex () { InitializeCriticalSection(&cs); }
+~SchedulerMutex () { DeleteCriticalSection(&cs); }
+void lock () { EnterCriticalSection(&cs); }
+void unlock () { LeaveCriticalSection(&cs); }
+};
+
+struct SchedulerSemaphore {
+HANDLE handle;
+SchedulerSemaphore (): handle(CreateSemaphore(NULL, 0, 0x7FFFFFFF, NULL)) {}
+~SchedulerSemaphore () { CloseHandle(handle); }
+void post () { ReleaseSemaphore(handle, 1, NULL); }
+bool wait (unsigned int ms) { return WaitForSingleObject(handle, ms)==WAIT_OBJECT_0; }
+};
+
+struct SchedulerEvent {
+HANDLE handle;
+SchedulerEvent (): handle(CreateEvent(NULL, TRUE, FALSE, NULL)) {}
+~SchedulerEvent () { CloseHandle(handle); }
+void set () { SetEvent(handle); }
+bool wait (unsigned int ms) { return WaitForSingleObject(handle, ms)==WAIT_OBJECT_0; }
+};
+
+static void StartWorkerThread (const function<void(void)>& f) { Thread::start(f); }
+
+static int GetProcessorCount () {
+SYSTEM_INFO si;
+GetSystemInfo(&si);
+return si.dwNumberOfProcessors;
+}
+
+#else
+#include<mutex>
+#include<condition_variable>
+#include<thread>
+
+typedef mutex SchedulerMutex;
+
+struct SchedulerSemaphore {
+mutex m;
+condition_variable cv;
+long count = 0;
+void post () { { lock_guard<mutex> l(m); count++; } cv.notify_one(); }
+bool wait (unsigned int ms) {
+unique_lock<mutex> l(m);
+auto ready = [&](){ return count>0; };
+if (ms==TASK_INFINITE) cv.wait(l, ready);
+else if (!cv.wait_for(l, chrono::milliseconds(ms), ready)) return false;
+count--;
+return true;
+}};
+
+struct SchedulerEvent {
+mutex m;
+condition_variable cv;
+bool signaled = false;
+void set () { { lock_guard<mutex> l(m); signaled = true; } cv.notify_all(); }
+bool wait (unsigned int ms) {
+unique_lock<mutex> l(m);
+auto ready = [&](){ return signaled; };
+if (ms==TASK_INFINITE) { cv.wait(l, ready); return true; }
+return cv.wait_for(l, chrono::milliseconds(ms), ready);
+}};
+
+static void StartWorkerThread (const function<void(void)>& f) { thread(f).detach(); }
+static int GetProcessorCount () { return thread::hardware_concurrency(); }
+#endif
+
+struct SchedulerLockGuard {
+SchedulerMutex& m;
+SchedulerLockGuard (SchedulerMutex& x): m(x) { m.lock(); }
+~SchedulerLockGuard () { m.unlock(); }
+};
+#define SCHEDULER_LOCK(m) SchedulerLockGuard ___SCHEDULER_LOCK_VAR##__LINE__ (m)
+
+#define TS_PENDING 0
+#define TS_RUNNING 1
+#define TS_DONE 2
+#define TS_CANCELLED 3
+
+struct CancellationFlag {
+atomic<bool> cancelled;
+CancellationFlag (): cancelled(false) {}
+};
+
+struct TaskState {
+function<void(void)> func;
+CancellationToken token;
+int priority;
+atomic<int> status;
+SchedulerMutex lock; // Protects continuations, and status once the task is finishing
+vector<shared_ptr<TaskState>> continuations;
+SchedulerEvent finished;
+exception_ptr exception; // Set before the task is marked as finished
+TaskState (const function<void(void)>& f, int p, const CancellationToken& t): func(f), token(t), priority(max(0, min(TASK_PRIORITIES -1, p))), status(TS_PENDING) {}
+};
+
+struct WorkerQueue {
+SchedulerMutex lock;
+deque<shared_ptr<TaskState>> tasks[TASK_PRIORITIES];
+};
+
+// Never destroyed, since workers may still be waiting on them when the process exits
+static SchedulerMutex& startLock = *new SchedulerMutex();
+static atomic<bool> workersStarted(false);
+static vector<WorkerQueue*> workers; // Never modified once the workers are started
+static WorkerQueue& injected = *new WorkerQueue(); // Tasks submitted from outside of the workers
+static SchedulerSemaphore& tasksAvailable = *new SchedulerSemaphore(); // One count per queued task
+static thread_local int currentWorker = -1;
+static thread_local TaskState* currentTask = NULL;
+
+static void WorkerLoop (int index);
+
+static void StartWorkers () {
+if (workersStarted) return;
+SCHEDULER_LOCK(startLock);
+if (workersStarted) return;
+int n = GetWorkerCount();
+for (int i=0; i<n; i++) workers.push_back(new WorkerQueue());
+workersStarted = true;
+for (int i=0; i<n; i++) StartWorkerThread([=](){ WorkerLoop(i); });
+}
+
+static void Enqueue (const shared_ptr<TaskState>& t) {
+StartWorkers();
+WorkerQueue& q = currentWorker>=0? *workers[currentWorker] : injected;
+{ SCHEDULER_LOCK(q.lock);
+q.tasks[t->priority].push_back(t);
+}
+tasksAvailable.post();
+}
+
+// The worker's own tasks are taken last in first out, tasks submitted from outside and stolen ones first in first out
+static shared_ptr<TaskState> TakeTask (int index) {
+shared_ptr<TaskState> t;
+int n = workers.size();
+for (int p=0; p<TASK_PRIORITIES; p++) {
+if (index>=0) { SCHEDULER_LOCK(workers[index]->lock);
+auto& d = workers[index]->tasks[p];
+if (!d.empty()) { t.swap(d.back()); d.pop_back(); return t; }
+}
+{ SCHEDULER_LOCK(injected.lock);
+auto& d = injected.tasks[p];
+if (!d.empty()) { t.swap(d.front()); d.pop_front(); return t; }
+}
+for (int k=1; k<=n; k++) {
+int victim = (max(index, 0) + k) %n;
+if (victim==index) continue;
+SCHEDULER_LOCK(workers[victim]->lock);
+auto& d = workers[victim]->tasks[p];
+if (!d.empty()) { t.swap(d.front()); d.pop_front(); return t; }
+}}
+return t;
+}
+
+static void FinishTask (const shared_ptr<TaskState>& t, int status) {
+vector<shared_ptr<TaskState>> continuations;
+{ SCHEDULER_LOCK(t->lock);
+t->status = status;
+continuations.swap(t->continuations);
+}
+t->func = nullptr;
+t->finished.set();
+for (auto& c: continuations) Enqueue(c);
+}
+
+static void RunTask (const shared_ptr<TaskState>& t) {
+if (t->token.IsCancelled()) {
+FinishTask(t, TS_CANCELLED);
+return;
+}
+t->status = TS_RUNNING;
+TaskState* previous = currentTask;
+currentTask = t.get();
+try {
+t->func();
+} catch (...) {
+t->exception = current_exception();
+}
+currentTask = previous;
+FinishTask(t, TS_DONE);
+}
+
+// A successful wait on tasksAvailable guarantees that a task is queued for this worker, though it may be found on another queue than the one it was put in
+static void RunNextTask (int index) {
+shared_ptr<TaskState> t;
+while (!(t = TakeTask(index))) {
+#ifdef _WIN32
+Sleep(0);
+#else
+this_thread::yield();
+#endif
+}
+RunTask(t);
+}
+
+static void WorkerLoop (int index) {
+currentWorker = index;
+while(true) {
+tasksAvailable.wait(TASK_INFINITE);
+RunNextTask(index);
+}}
+
+CancellationToken::CancellationToken (): flag(make_shared<CancellationFlag>()) {}
+
+void CancellationToken::Cancel () {
+flag->cancelled = true;
+}
+
+bool CancellationToken::IsCancelled () const {
+return flag->cancelled;
+}
+
+bool Task::IsDone () const {
+int s = state->status;
+return s==TS_DONE || s==TS_CANCELLED;
+}
+
+bool Task::IsCancelled () const {
+return state->status==TS_CANCELLED;
+}
+
+void Task::Cancel () {
+state->token.Cancel();
+}
+
+bool Task::Wait (unsigned int ms) const {
+if (currentWorker<0) return state->finished.wait(ms);
+/* A worker waiting for another task keeps running queued tasks until it is finished, so that workers waiting for tasks which are still queued can't exhaust the pool
+Tasks waiting for each other in a cycle, or for something else than a task, still block their workers
+*/
+auto deadline = chrono::steady_clock::now() + chrono::milliseconds(ms);
+while (!IsDone()) {
+if (tasksAvailable.wait(0)) RunNextTask(currentWorker);
+else if (state->finished.wait(1)) break;
+else if (ms!=TASK_INFINITE && chrono::steady_clock::now()>=deadline) return false;
+}
+return true;
+}
+
+exception_ptr Task::GetException () const {
+return IsDone()? state->exception : exception_ptr();
+}
+
+Task Task::Then (const function<void(void)>& f, int priority) const {
+auto t = make_shared<TaskState>(f, priority, state->token);
+bool finished;
+{ SCHEDULER_LOCK(state->lock);
+int s = state->status;
+finished = s==TS_DONE || s==TS_CANCELLED;
+if (!finished) state->continuations.push_back(t);
+}
+if (finished) Enqueue(t);
+return Task{t};
+}
+
+Task export SubmitTask (const function<void(void)>& f, int priority, const CancellationToken& token) {
+auto t = make_shared<TaskState>(f, priority, token);
+Enqueue(t);
+return Task{t};
+}
+
+bool export IsCurrentTaskCancelled () {
+return currentTask && currentTask->token.IsCancelled();
+}
+
+bool export IsWorkerThread () {
+return currentWorker>=0;
+}
+
+int export GetWorkerCount () {
+return max(2, GetProcessorCount());
+}
@@ -0,0 +1,55 @@
+#ifndef ___TASKSCHEDULER_H9
+#define ___TASKSCHEDULER_H9
+#ifdef _WIN32
+#include "global.h"
+#else
+#define export
+#endif
+#include<functional>
+#include<memory>
+#include<exception>
+
+#define TASK_HIGH 0
+#define TASK_NORMAL 1
+#define TASK_LOW 2
+#define TASK_PRIORITIES 3
+#define TASK_INFINITE 0xFFFFFFFF
+
+struct TaskState;
+struct CancellationFlag;
+
+// Shared by the tasks which can be cancelled together; tasks not yet started when it is cancelled don't run, running ones may check IsCurrentTaskCancelled
+struct export CancellationToken {
+std::shared_ptr<CancellationFlag> flag;
+CancellationToken ();
+void Cancel ();
+bool IsCancelled () const;
+};
+
+// Handle to a task submitted to the scheduler, which may be waited for or followed by other tasks
+struct export Task {
+std::shared_ptr<TaskState> state;
+// Finished running, or cancelled before it could run
+bool IsDone () const;
+bool IsCancelled () const;
+void Cancel ();
+// Return false if the task isn't finished after the given number of milliseconds; waiting from a worker runs other queued tasks meanwhile
+bool Wait (unsigned int ms = TASK_INFINITE) const;
+// Exception thrown by the task, if any; it isn't propagated otherwise
+std::exception_ptr GetException () const;
+// Run f once this task is finished or cancelled, with the same cancellation token
+Task Then (const std::function<void(void)>& f, int priority = TASK_NORMAL) const;
+explicit operator bool () const { return !!state; }
+};
+
+/* Run f on one of the worker threads, started on first use, one per processor
+Each worker has its own queues, so that tasks submitted by a task stay on the same worker unless idle workers steal them; higher priorities are always taken first
+*/
+Task export SubmitTask (const std::function<void(void)>& f, int priority = TASK_NORMAL, const CancellationToken& token = CancellationToken());
+// Whether the task running on the current thread has been cancelled
+bool export IsCurrentTaskCancelled ();
+// Whether the current thread is one of the workers
+bool export IsWorkerThread ();
+int export GetWorkerCount ();
+
+#endif
@@ -0,0 +1,113 @@
+#include "TextWriter.h"
+using namespace std;
+
+TextWriter::TextWriter (File& f, int enc, int le, int size):
+fd(f), encoding(enc), lineEnding(le), bufferSize(max(size,64)), pos(0), blankStart(0),
+pendingCR(false), ok(!!f), empty(true), lastEol(false),
+trimTrailingSpaces(false), insertFinalNewline(false), recordTrims(false), finalNewlineAdded(false),
+trimmed(), chars(), blanks(), bytes()
+{
+chars.reserve(bufferSize);
+bytes.reserve(bufferSize + bufferSize/2);
+bytes = GetEncodingSignature(encoding);
+}
+
+void TextWriter::putLineEnding () {
+switch(lineEnding){
+case LE_UNIX: chars += '\n'; break;
+case LE_MAC: chars += '\r'; break;
+case LE_RS: chars += (TCHAR)0x1E; break;
+case LE_LS: chars += (TCHAR)0x2028; break;
+default: chars += TEXT("\r\n"); break;
+}
+empty = false;
+lastEol = true;
+}
+
+void TextWriter::dropBlanks () {
+if (blanks.size()<=0) return;
+if (recordTrims) trimmed.push_back(make_pair(blankStart, (int)blanks.size()));
+blanks.clear();
+}
+
+void TextWriter::flushBlanks () {
+if (blanks.size()<=0) return;
+chars += blanks;
+blanks.clear();
+empty = lastEol = false;
+}
+
+void TextWriter::flush () {
+if (ok && bytes.size()>0) ok = fd.writeFully(bytes.data(), bytes.size());
+bytes.clear();
+}
+
+void TextWriter::encode (bool all) {
+int n = chars.size();
+// Never split a surrogate pair between two chunks
+if (!all && n>0 && chars[n -1]>=0xD800 && chars[n -1]<=0xDBFF) n--;
+AppendEncodedText(bytes, chars.data(), n, encoding);
+chars.erase(0, n);
+if (all || bytes.size()>=bufferSize) flush();
+}
+
+bool export TextWriter::write (const TCHAR* str, int len) {
+const TCHAR *s = str, *end = str+len;
+while (ok && s<end) {
+// A CR not followed by LF is a line ending on its own, even if blanks to trim come next
+if (pendingCR) {
+pendingCR = false;
+if (*s=='\n') {
+dropBlanks();
+putLineEnding();
+s++; pos++;
+continue;
+}
+chars += '\r';
+empty = false;
+lastEol = true;
+}
+const TCHAR *lim = s + min<int>(end-s, max<int>(1, bufferSize-chars.size())), *t = s;
+if (!trimTrailingSpaces) t = (lineEnding==LE_DOS? lim : find(s, lim, '\r'));
+else while (t<lim && *t>' ') t++;
+if (t>s) {
+flushBlanks();
+chars.append(s, t);
+pos += t-s;
+empty = false;
+lastEol = (t[-1]=='\n' || t[-1]=='\r');
+s = t;
+}
+if (s<lim) {
+TCHAR c = *s++;
+switch(c){
+case '\r': dropBlanks(); pendingCR=true; break;
+case '\n': dropBlanks(); chars += c; empty=false; lastEol=true; break;
+case ' ': case '\t':
+if (blanks.size()<=0) blankStart = pos;
+blanks += c;
+break;
+default: flushBlanks(); chars += c; empty=lastEol=false; break;
+}
+pos++;
+}
+if (chars.size()+2>=bufferSize) encode();
+}
+return ok;
+}
+
+bool export TextWriter::finish () {
+if (pendingCR) {
+chars += '\r';
+empty = false;
+lastEol = true;
+pendingCR = false;
+}
+dropBlanks();
+if (insertFinalNewline && !empty && !lastEol) {
+putLineEnding();
+finalNewlineAdded = true;
+}
+encode(true);
+return ok;
+}
@@ -0,0 +1,28 @@
+#ifndef ___TEXTWRITER_H9
+#define ___TEXTWRITER_H9
+#include "global.h"
+#include "File.h"
+
+struct export TextWriter {
+File& fd;
+int encoding, lineEnding, bufferSize, pos, blankStart;
+bool pendingCR, ok, empty, lastEol;
+bool trimTrailingSpaces, insertFinalNewline, recordTrims, finalNewlineAdded;
+std::vector<std::pair<int,int>> trimmed;
+tstring chars, blanks;
+string bytes;
+
+TextWriter (File& f, int encoding, int lineEnding, int bufferSize = 65536);
+bool export write (const TCHAR* str, int len);
+inline bool write (const tstring& str) { return write(str.data(), str.size()); }
+bool export finish ();
+
+private:
+void putLineEnding ();
+void dropBlanks ();
+void flushBlanks ();
+void encode (bool all = false);
+void flush ();
+};
+
+#endif
@@ -3,6 +3,7 @@
 #include "global.h"
 #include "sixpad.h"
 #include<functional>
+#include<tuple>
 
 typedef std::function<void(void)> Proc;
 
@@ -28,9 +29,16 @@ Proc f(cf);
 SendMessage(SPPTR win, WM_RUNPROC, del, &f);
 }
 
-template<class F> inline void RunAsync (const F& cf, bool del = true) {
-Proc* f = new Proc(cf);
-PostMessage(SPPTR win, WM_RUNPROC, del, f);
+/* Procs run asynchronously are put in a lock-free queue, drained by the UI thread in batches upon a single WM_RUNQUEUE message
+Threads other than the UI thread wait when too many procs are already queued
+*/
+void export PostToUIThread (Proc&& f);
+void export RunUIQueue ();
+// Number of procs queued, of WM_RUNQUEUE messages posted, maximum queue depth, number of times producers had to wait, and average and maximum latency in microseconds
+std::tuple<int,int,int,int,double,double> export GetUIQueueStatistics ();
+
+template<class F> inline void RunAsync (const F& cf) {
+PostToUIThread(Proc(cf));
 }
 
 struct RAII_CRITICAL_SECTION {
@@ -0,0 +1,84 @@
+#include "Thread.h"
+#include "MPSCQueue.h"
+#include "TaskScheduler.h"
+#include "python34.h"
+#include<algorithm>
+using namespace std;
+
+#define UI_QUEUE_CAPACITY 65536
+#define UI_QUEUE_BATCH_TIME 15 // Milliseconds spent running queued procs before letting other messages through
+
+struct QueuedProc {
+Proc proc;
+long long time;
+};
+
+static MPSCQueue<QueuedProc> uiQueue;
+static atomic<bool> wakeupPending(false);
+static atomic<int> procsQueued(0), wakeups(0), maxDepth(0), producerWaits(0);
+static long long latencyTotal = 0, latencyMax = 0, procsRun = 0; // Only modified by the UI thread
+static HANDLE spaceAvailable;
+static struct UIQueueInit { UIQueueInit () { spaceAvailable = CreateEvent(NULL, FALSE, FALSE, NULL); } } uiQueueInit;
+
+static inline long long Now () {
+LARGE_INTEGER li;
+QueryPerformanceCounter(&li);
+return li.QuadPart;
+}
+
+static void WaitForSpace () {
+// Let the UI thread take the GIL, it may need it to run the procs ahead in the queue
+if (!Py_IsInitialized() || !PyGILState_Check()) WaitForSingleObject(spaceAvailable, 50);
+else {
+Py_BEGIN_ALLOW_THREADS
+WaitForSingleObject(spaceAvailable, 50);
+Py_END_ALLOW_THREADS
+}}
+
+// A single message is pending at any time, however many procs are queued
+static void Wakeup () {
+if (wakeupPending.exchange(true)) return;
+wakeups++;
+PostMessage(sp->win, WM_RUNQUEUE, 0, 0);
+}
+
+void export PostToUIThread (Proc&& f) {
+// Producers are held back while the UI thread doesn't keep up; the UI thread never waits for itself
+// Neither do scheduler tasks, since the UI thread may be waiting for them, i.e. for a save to complete
+if (uiQueue.size()>=UI_QUEUE_CAPACITY && !IsUIThread() && !IsWorkerThread()) {
+producerWaits++;
+do WaitForSpace(); while (uiQueue.size()>=UI_QUEUE_CAPACITY);
+}
+int depth = uiQueue.push({ move(f), Now() });
+procsQueued++;
+for (int m=maxDepth; depth>m && !maxDepth.compare_exchange_weak(m, depth); );
+Wakeup();
+}
+
+void export RunUIQueue () {
+// Cleared first: a proc queued from now on either is run by this batch, or posts a new wakeup
+wakeupPending = false;
+LARGE_INTEGER freq;
+QueryPerformanceFrequency(&freq);
+long long start = Now(), budget = freq.QuadPart * UI_QUEUE_BATCH_TIME / 1000;
+QueuedProc q;
+while (uiQueue.pop(q)) {
+long long latency = Now() - q.time;
+latencyTotal += latency;
+latencyMax = max(latencyMax, latency);
+procsRun++;
+q.proc();
+q.proc = nullptr;
+if (Now() - start > budget) {
+if (uiQueue.size()>0) Wakeup();
+break;
+}}
+SetEvent(spaceAvailable);
+}
+
+std::tuple<int,int,int,int,double,double> export GetUIQueueStatistics () {
+LARGE_INTEGER freq;
+QueryPerformanceFrequency(&freq);
+double us = 1000000.0 / freq.QuadPart;
+return std::make_tuple((int)procsQueued, (int)wakeups, (int)maxDepth, (int)producerWaits, procsRun? latencyTotal * us / procsRun : 0.0, latencyMax * us);
+}
@@ -0,0 +1,202 @@
+#include "File.h"
+#include "Thread.h"
+#include<unordered_map>
+using namespace std;
+
+#define ZIP_MAX_CACHED_ARCHIVES 16
+
+IO* CreateInflatingReader (IO* input, unsigned int expectedCrc, unsigned int expectedSize);
+
+struct ZipEntry {
+tstring name;
+int method, flags;
+unsigned long long offset, compressedSize, size;
+unsigned int crc;
+};
+
+struct ZipDirectory {
+unsigned long long lastModified;
+int archiveSize;
+vector<ZipEntry> entries;
+unordered_map<tstring,int> index;
+const ZipEntry* find (const tstring& name);
+};
+
+struct ZipMemberIO: IO {
+IO* archive;
+const char* data;
+int len, pos;
+ZipMemberIO (IO* a, const char* d, int l): archive(a), data(d), len(l), pos(0) {}
+int Read (void* buf, int n) {
+if (!archive) return -1;
+n = min(n, len-pos);
+memcpy(buf, data+pos, n);
+pos+=n;
+return n;
+}
+int Write (const void*, int) { return -1; }
+int size () { return len; }
+void Flush () {}
+void Close () {
+if (archive) {
+archive->Close();
+delete archive;
+}
+archive = NULL;
+}
+bool IsClosed () { return !archive; }
+boost::string_ref View () { return archive? boost::string_ref(data, len) : boost::string_ref(); }
+};
+
+static inline unsigned int le16 (const char* p) { return (unsigned char)p[0] | ((unsigned char)p[1]<<8); }
+static inline unsigned int le32 (const char* p) { return le16(p) | (le16(p+2)<<16); }
+static inline unsigned long long le64 (const char* p) { return le32(p) | ((unsigned long long)le32(p+4)<<32); }
+
+// Sizes and offset of 4 GiB or more are set to 0xFFFFFFFF in the central directory, the actual values follow in that order in the zip64 extra field
+static bool ReadZip64ExtraField (ZipEntry& e, const char* extra, int extraLen) {
+for (const char* p = extra; p+4<=extra+extraLen; p += 4 + le16(p+2)) {
+if (le16(p)!=0x0001) continue;
+const char *q = p+4, *end = min(p + 4 + le16(p+2), extra+extraLen);
+for (unsigned long long* field: { &e.size, &e.compressedSize, &e.offset }) {
+if (*field!=0xFFFFFFFF) continue;
+if (q+8>end) return false;
+*field = le64(q);
+q += 8;
+}
+return true;
+}
+return false;
+}
+
+const ZipEntry* ZipDirectory::find (const tstring& name) {
+auto it = index.find(name);
+if (it!=index.end()) return &entries[it->second];
+for (auto& e: entries) if (iequals(e.name, name)) return &e;
+return NULL;
+}
+
+static shared_ptr<ZipDirectory> ParseZipDirectory (boost::string_ref data) {
+const char *start = data.data(), *end = start + data.size(), *eocd = NULL;
+if (data.size()<22) return NULL;
+// The end of central directory record is followed by a comment of up to 65535 bytes
+for (const char* p = end -22; p>=start && p>=end -22 -65535; p--) {
+if (le32(p)==0x06054b50) { eocd=p; break; }
+}
+if (!eocd) return NULL;
+unsigned long long count = le16(eocd+10), cdOffset = le32(eocd+16);
+if ((count==0xFFFF || cdOffset==0xFFFFFFFF) && eocd-20>=start && le32(eocd-20)==0x07064b50) { // Zip64
+unsigned long long zip64Offset = le64(eocd-20+8);
+if (zip64Offset+56>data.size() || le32(start+zip64Offset)!=0x06064b50) return NULL;
+count = le64(start+zip64Offset+32);
+cdOffset = le64(start+zip64Offset+48);
+}
+// Each entry takes at least 46 bytes
+if (cdOffset>data.size() || count>(data.size()-cdOffset)/46) return NULL;
+auto dir = make_shared<ZipDirectory>();
+dir->entries.reserve(count);
+const char* p = start + cdOffset;
+for (unsigned long long i=0; i<count; i++) {
+if (p<start || p+46>end || le32(p)!=0x02014b50) return NULL;
+int flags = le16(p+8), nameLen = le16(p+28), extraLen = le16(p+30), commentLen = le16(p+32);
+if (p+46+nameLen+extraLen>end) return NULL;
+ZipEntry e;
+string name(p+46, nameLen);
+e.name = toTString(toWString(name, (flags&0x800)? CP_UTF8 : 437));
+e.flags = flags;
+e.method = le16(p+10);
+e.crc = le32(p+16);
+e.compressedSize = le32(p+20);
+e.size = le32(p+24);
+e.offset = le32(p+42);
+if ((e.size==0xFFFFFFFF || e.compressedSize==0xFFFFFFFF || e.offset==0xFFFFFFFF) && !ReadZip64ExtraField(e, p+46+nameLen, extraLen)) return NULL;
+dir->index[e.name] = dir->entries.size();
+dir->entries.push_back(e);
+p += 46 + nameLen + extraLen + commentLen;
+}
+return dir;
+}
+
+static CRITICAL_SECTION zipCacheLock;
+static unordered_map<tstring, shared_ptr<ZipDirectory>> zipCache;
+static struct ZipCacheInit { ZipCacheInit () { InitializeCriticalSection(&zipCacheLock); } } zipCacheInit;
+
+static shared_ptr<ZipDirectory> GetZipDirectory (const tstring& archive, boost::string_ref data) {
+tstring key = to_lower_copy(archive);
+unsigned long long lastModified = GetFileTime(archive.c_str(), LAST_MODIFIED_TIME);
+{ SCOPE_LOCK(zipCacheLock);
+auto it = zipCache.find(key);
+if (it!=zipCache.end() && it->second->lastModified==lastModified && it->second->archiveSize==data.size()) return it->second;
+}
+auto dir = ParseZipDirectory(data);
+if (!dir) return NULL;
+dir->lastModified = lastModified;
+dir->archiveSize = data.size();
+SCOPE_LOCK(zipCacheLock);
+if (zipCache.size()>=ZIP_MAX_CACHED_ARCHIVES) zipCache.clear();
+zipCache[key] = dir;
+return dir;
+}
+
+static IO* OpenZipArchive (const tstring& archive, boost::string_ref& data) {
+IO* io = File::openIO(archive);
+if (!io) return NULL;
+data = io->View();
+if (data.size()<=0) {
+io->Close();
+delete io;
+return NULL;
+}
+return io;
+}
+
+static bool SplitZipPath (const tstring& uri, tstring& archive, tstring& member) {
+if (!starts_with(uri, TEXT("zip://"))) return false;
+int pos = uri.find('!', 6);
+if (pos<0 || pos>=uri.size()) return false;
+archive = uri.substr(6, pos -6);
+member = uri.substr(pos+1);
+replace_all(member, TEXT("\\"), TEXT("/"));
+while (member.size()>0 && member[0]=='/') member.erase(member.begin());
+return archive.size()>0 && member.size()>0;
+}
+
+IO* ZipProtocolHandler (const tstring& uri, bool write, bool append) {
+tstring archive, member;
+if (!SplitZipPath(uri, archive, member)) return NULL;
+if (write) return new ZipMemberIO(NULL, NULL, 0); // Archives are read-only
+boost::string_ref data;
+IO* io = OpenZipArchive(archive, data);
+if (!io) return NULL;
+auto dir = GetZipDirectory(archive, data);
+const ZipEntry* e = dir? dir->find(member) : NULL;
+// Members are exposed through IO, whose sizes are int: members of 2 GiB or more can't be opened
+if (!e || (e->flags&1) || (e->method!=0 && e->method!=8) // Not found, encrypted, or unsupported compression method
+|| e->size>0x7FFFFFFF || e->compressedSize>0x7FFFFFFF
+|| e->offset+30>data.size() || le32(data.data() + e->offset)!=0x04034b50) {
+io->Close();
+delete io;
+return new ZipMemberIO(NULL, NULL, 0);
+}
+const char* local = data.data() + e->offset;
+unsigned long long dataOffset = e->offset + 30 + le16(local+26) + le16(local+28);
+if (dataOffset+e->compressedSize>data.size()) {
+io->Close();
+delete io;
+return new ZipMemberIO(NULL, NULL, 0);
+}
+IO* re = new ZipMemberIO(io, data.data()+dataOffset, e->compressedSize);
+if (e->method==8) re = CreateInflatingReader(re, e->crc, e->size);
+return re;
+}
+
+vector<tstring> export ListZipArchive (const tstring& archive) {
+vector<tstring> names;
+boost::string_ref data;
+IO* io = OpenZipArchive(archive, data);
+if (!io) return names;
+auto dir = GetZipDirectory(archive, data);
+if (dir) for (auto& e: dir->entries) names.push_back(e.name);
+io->Close();
+delete io;
+return names;
+}
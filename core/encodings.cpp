@@ -21,9 +21,10 @@ EnumPythonBonusCP(enclist);
 return enclist;
 }
 
-tstring decodeFromPythonEncoding (const string& str, int offset, const char* encoding) {
+tstring decodeFromPythonEncoding (const char* str, int len, const char* encoding) {
+if (len<=0) return TEXT("");
 GIL_PROTECT
-PyObject* obj = PyUnicode_Decode(str.data()+offset, str.size()-offset, encoding, NULL);
+PyObject* obj = PyUnicode_Decode(str, len, encoding, NULL);
 if (!obj) { PyErr_Clear(); return TEXT(""); }
 tstring re = PyUnicode_AsUnicode(obj);
 Py_DECREF(obj);
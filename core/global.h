@@ -72,6 +72,7 @@ inline bool IsUnicode () { return false; }
 //#define CP_MSDOS 850
 
 #define WM_RUNPROC WM_USER + 1563
+#define WM_RUNQUEUE WM_USER + 1564
 
 #define IDC_TABCTL 1
 #define IDC_STATUSBAR 2
@@ -125,6 +126,8 @@ inline bool IsUnicode () { return false; }
 #define IDM_SELECTFONT 2236
 #define IDM_OTHER_ENCODINGS 2237
 #define IDM_QUICKJUMP 2238
+#define IDM_GOTOMATCH 2239
+#define IDM_SELTOMATCH 2240
 #define IDM_OPEN_CONSOLE 2300
 #define IDM_USER_COMMAND 3000
 
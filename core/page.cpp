@@ -1,12 +1,17 @@
 #include "global.h"
 #include "page.h"
 #include "file.h"
+#include "TextWriter.h"
+#include "FileWatcher.h"
+#include "RecoveryJournal.h"
+#include "SessionSnapshot.h"
+#include "StructureIndex.h"
+#include "BracketIndex.h"
 #include "inifile.h"
 #include "dialogs.h"
 #include "sixpad.h"
 #include<sstream>
 #include<unordered_map>
-#include<fcntl.h>
 using namespace std;
 
 #define FF_CASE 1
@@ -45,6 +50,23 @@ void Redo (Page&);
 int GetTypeId () { return 3; }
 };
 
+struct TextEdit {
+int start;
+tstring oldText, newText;
+TextEdit (int s, const tstring& o, const tstring& n): start(s), oldText(o), newText(n) {}
+};
+
+struct TextEditsApplied: UndoState {
+vector<TextEdit> edits; // sorted and non-overlapping, positions are taken before any of the edits is applied
+bool wholeText = false; // The last Apply replaced the whole text with SetText, which already recorded the change
+TextEditsApplied (const vector<TextEdit>& e): edits(e) {}
+void Apply (Page&, bool undo);
+void Undo (Page& p) { Apply(p, true); }
+void Redo (Page& p) { Apply(p, false); }
+int MapPosition (int pos);
+int GetTypeId () { return 4; }
+};
+
 struct FindData {
 tstring findText, replaceText;
 int flags;
@@ -60,7 +82,30 @@ void PrepareSmartPaste (tstring& text, const tstring& indent);
 tstring GetMenuName (HMENU, UINT, BOOL);
 void SetMenuName (HMENU, UINT, BOOL, LPCTSTR);
 
+// Indexes and timers belong to the UI thread
+static void DiscardUIState (Page* p, int tailTimer) {
+DiscardStructureIndex(p);
+DiscardBracketIndex(p);
+if (tailTimer) sp->ClearTimeout(tailTimer);
+}
+
 Page::~Page () { 
+WaitForSave();
+UnwatchFile(this);
+DiscardJournal(this);
+// Normally done by Close already; a page released by a script is destroyed on its thread, possibly holding the GIL, where RunSync could deadlock
+if (IsUIThread()) DiscardUIState(this, tailTimer);
+else {
+Page* key = this;
+int timer = tailTimer;
+RunAsync([=](){ DiscardUIState(key, timer); });
+}}
+
+static void MarkFileSynchronized (Page& p) {
+p.lastSave = GetCurTime();
+p.flags &=~PF_CHANGEDONDISK;
+WatchFile(p.shared_from_this());
+DiscardJournal(&p);
 }
 
 void Page::SetName (const tstring& n) { 
@@ -106,25 +151,33 @@ onattrChange(shared_from_this(), PA_AUTOLINEBREAK, b);
 
 bool Page::Close () { 
 if (!onclose(shared_from_this() )) return false;
-if (flags&PF_WRITETOSTDOUT) { 
-setmode(fileno(stdout),O_BINARY);
-printf("%s", SaveData().c_str() );
-fflush(stdout);
+WaitForSave();
+auto closed = [&](){
+DiscardUIState(this, tailTimer);
+tailTimer = 0;
 onclosed(shared_from_this());
+};
+if (flags&PF_WRITETOSTDOUT) { 
+File fd(TEXT("&out:"), true);
+SaveData(fd);
+fd.flush();
+closed();
 return true;
 }
 if (!IsModified()) {
-onclosed(shared_from_this());
+DiscardJournal(this);
+closed();
 return true;
 }
 int re = MessageBox2(sp->win, name, tsnprintf(512, msg("%s has been modified."), name.c_str()), tsnprintf(512, msg("Save changes to %s?"), name.c_str()), {msg("&Save"), msg("Do&n't save"), msg("&Cancel")}, MB2_ICONEXCLAMATION);
 if (re==0) {
 bool result = Save();
-if (result) onclosed(shared_from_this());
+if (result) closed();
 return result;
 }
 else if (re==1) {
-onclosed(shared_from_this());
+DiscardJournal(this);
+closed();
 return true;
 }
 return false;
@@ -192,6 +245,17 @@ tstring Page::GetText ()  {
 return GetWindowText(zone);
 }
 
+shared_ptr<const tstring> Page::GetTextSnapshot () {
+int len = GetTextLength();
+if (textSnapshot && textSnapshotGeneration==editGeneration) return textSnapshot;
+HLOCAL hLoc = (HLOCAL)SendMessage(zone, EM_GETHANDLE, 0, 0);
+LPCTSTR text = (LPCTSTR)LocalLock(hLoc);
+textSnapshot = make_shared<const tstring>(text, len);
+LocalUnlock(hLoc);
+textSnapshotGeneration = editGeneration;
+return textSnapshot;
+}
+
 tstring Page::GetLine (int line) {
 return EditGetLine(zone, line);
 }
@@ -240,6 +304,8 @@ void Page::SetText (const tstring& str) {
 int start, end;
 SendMessage(zone, EM_GETSEL, &start, &end);
 SetWindowText(zone, str);
+editGeneration++;
+JournalTextChanged(*this);
 SendMessage(zone, EM_SETSEL, start, end);
 if (IsWindowVisible(zone)) SendMessage(zone, EM_SCROLLCARET, 0, 0);
 }
@@ -258,11 +324,13 @@ PushUndoState(shared_ptr<UndoState>(new TextReplaced( start, oldStr, newStr, !ke
 }
 
 void Page::SetSelectedText (const tstring& str) {
-int start;
-SendMessage(zone, EM_GETSEL, &start, 0);
+int start, end;
+SendMessage(zone, EM_GETSEL, &start, &end);
+tstring oldStr = GetTextSubstring(start, end);
 SendMessage(zone, EM_REPLACESEL, 0, str.c_str());
 SendMessage(zone, EM_SETSEL, start, start+str.size());
 if (IsWindowVisible(zone)) SendMessage(zone, EM_SCROLLCARET, 0, 0);
+PushUndoState(shared_ptr<UndoState>(new TextReplaced(start, oldStr, str, true)));
 }
 
 PyObject* CreatePyPageObject (shared_ptr<Page>);
@@ -405,19 +473,86 @@ if (!GlobMatches(file, toTString(sect.first))) continue;
 ini.fusion(*sect.second);
 }}
 
-string Page::SaveData () {
+template<class T> static void SetEditorConfigFlags (T& p, IniFile& ini) {
+unsigned long long f = 0;
+if (ini.get("trim_trailing_whitespace", false)) f |= PF_TRIMTRAILINGSPACES;
+if (ini.get("insert_final_newline", false)) f |= PF_INSERTFINALNEWLINE;
+if (ini.get("_6p_fix_buffer_on_save", false)) f |= PF_FIXBUFFERONSAVE;
+p.flags = (p.flags&~(PF_TRIMTRAILINGSPACES|PF_INSERTFINALNEWLINE|PF_FIXBUFFERONSAVE)) | f;
+}
+
+// Applies all the edits at once without redrawing in between, as a single undo state
+static void ApplyTextEdits (Page& p, vector<TextEdit>& edits) {
+int start, end;
+p.GetSelection(start, end);
+auto u = make_shared<TextEditsApplied>(vector<TextEdit>());
+u->edits.swap(edits);
+SendMessage(p.zone, WM_SETREDRAW, FALSE, 0);
+u->Redo(p);
+SendMessage(p.zone, EM_SETSEL, u->MapPosition(start), u->MapPosition(end));
+SendMessage(p.zone, WM_SETREDRAW, TRUE, 0);
+InvalidateRect(p.zone, NULL, TRUE);
+p.PushUndoState(u, false);
+}
+
+static void ApplySaveFixes (Page& p, const vector<pair<int,int>>& trimmed, bool finalNewline) {
+vector<TextEdit> edits;
+for (auto& r: trimmed) edits.push_back(TextEdit(r.first, p.GetTextSubstring(r.first, r.first+r.second), TEXT("")));
+if (finalNewline) edits.push_back(TextEdit(p.GetTextLength(), TEXT(""), TEXT("\r\n")));
+if (edits.size()<=0) return;
+ApplyTextEdits(p, edits);
+}
+
+bool Page::ApplyEdits (vector<tuple<int,int,tstring>>& edits) {
+// Insertions at the same position keep their relative order
+stable_sort(edits.begin(), edits.end(), [](const tuple<int,int,tstring>& a, const tuple<int,int,tstring>& b){ return get<0>(a)<get<0>(b) || (get<0>(a)==get<0>(b) && get<1>(a)<get<1>(b)); });
+int len = GetTextLength(), last = 0;
+for (auto& e: edits) {
+if (get<0>(e)<last || get<1>(e)<get<0>(e) || get<1>(e)>len) return false;
+last = get<1>(e);
+}
+if (edits.empty()) return true;
+vector<TextEdit> textEdits;
+textEdits.reserve(edits.size());
+HLOCAL hLoc = (HLOCAL)SendMessage(zone, EM_GETHANDLE, 0, 0);
+LPCTSTR text = (LPCTSTR)LocalLock(hLoc);
+for (auto& e: edits) textEdits.push_back(TextEdit(get<0>(e), tstring(text+get<0>(e), text+get<1>(e)), get<2>(e)));
+LocalUnlock(hLoc);
+ApplyTextEdits(*this, textEdits);
+return true;
+}
+
+static inline void SetupTextWriter (Page& p, TextWriter& writer) {
+writer.trimTrailingSpaces = !!(p.flags&PF_TRIMTRAILINGSPACES);
+writer.insertFinalNewline = !!(p.flags&PF_INSERTFINALNEWLINE);
+writer.recordTrims = !!(p.flags&PF_FIXBUFFERONSAVE);
+}
+
+bool Page::SaveData (File& fd) {
+TextWriter writer(fd, encoding, lineEnding);
+SetupTextWriter(*this, writer);
+if (!onsave.empty()) {
 tstring str = GetText();
 optional<tstring> re = onsave(shared_from_this(), str);
-if (re) str = *re;
-if (lineEnding==LE_UNIX) str = replace_all_copy(str, TEXT("\r\n"), TEXT("\n"));
-else if (lineEnding==LE_MAC) str = replace_all_copy(str, TEXT("\r\n"), TEXT("\r"));
-else if (lineEnding==LE_RS) str = replace_all_copy(str, TEXT("\r\n"), TEXT("\x1E"));
-else if (lineEnding==LE_LS) str = replace_all_copy(str, TEXT("\r\n"), TEXT("\x2028"));
-string cstr = ConvertToEncoding(str, encoding);
-return cstr;
+if (re) {
+str = *re;
+writer.recordTrims = false;
+}
+writer.write(str);
+}
+else { // Nobody wants to see the text, stream it straight from the edit buffer
+int len = GetTextLength();
+HLOCAL hLoc = (HLOCAL)SendMessage(zone, EM_GETHANDLE, 0, 0);
+LPCTSTR text = (LPCTSTR)LocalLock(hLoc);
+writer.write(text, len);
+LocalUnlock(hLoc);
+}
+if (!writer.finish()) return false;
+if (writer.recordTrims) ApplySaveFixes(*this, writer.trimmed, writer.finalNewlineAdded);
+return true;
 }
 
-bool Page::SaveFile (const tstring& newFile) {
+bool Page::SaveFile (const tstring& newFile, bool async) {
 if (flags&PF_NOSAVE) return false;
 if ((flags&PF_MUSTSAVEAS) && newFile.size()<=0) return false;
 if (newFile.size()>0) {
@@ -431,8 +566,7 @@ ReadDotEditorconfigs(file, ini);
 int le = elt(to_upper_copy(ini.get("end_of_line",string("0"))), lineEnding, {"CRLF", "LF", "CR", "RS", "LS"});
 int enc = eltm(to_lower_copy(ini.get("charset",string("0"))), encoding, {{"latin1", 1252}, {"latin-1", 1252}, {"utf-8", 65001}, {"utf8", 65001}, {"utf-16le", 1200}, {"utf-16be", 1201}, {"utf-8-bom", 65002}});
 int im = elt(to_lower_copy(ini.get("indent_style",string("0"))), indentationMode, {"tab", "space"});
-bool trimEol = ini.get("trim_trailing_whitespace", false); //todo: flag and apply this setting
-bool eofNewline = ini.get("insert_final_newline", false); //todo: flag and apply this setting
+SetEditorConfigFlags(*this, ini);
 if (im) im = ini.get("indent_size", 4);
 if (le!=lineEnding) SetLineEnding(le);
 if (enc!=encoding) SetEncoding(enc);
@@ -441,26 +575,233 @@ if (im!=indentationMode) SetIndentationMode(im);
 optional<tstring> re = onbeforeSave(shared_from_this(), file);
 if (re) file = *re;
 if (file.size()<=0) return false;
-string cstr = SaveData();
-SetModified(false);
+if (async && GetTextLength()>=sp->config->get("asyncSaveThreshold", 1048576)) return SaveFileInBackground();
+WaitForSave();
 File fd(file, true);
 if (!fd) return false;
-fd.writeFully(cstr.data(), cstr.size());
-lastSave = GetCurTime();
+if (!SaveData(fd)) return false;
+SetModified(false);
+MarkFileSynchronized(*this);
 return true; 
 }
 
-bool Page::Save (bool saveAs) {
+bool Page::SaveFileInBackground () {
+WaitForSave();
+auto str = make_shared<tstring>(GetText());
+optional<tstring> re = onsave(shared_from_this(), *str);
+if (re) *str = *re;
+bool fixBuffer = !re && (flags&PF_FIXBUFFERONSAVE);
+SetModified(false);
+flags |= PF_SAVING;
+weak_ptr<Page> wp = shared_from_this();
+tstring fn = file, pageName = name;
+int le = lineEnding, enc = encoding;
+unsigned long long fl = flags;
+saveTask = SubmitTask([=]()mutable{
+File fd(fn, true);
+TextWriter writer(fd, enc, le);
+writer.trimTrailingSpaces = !!(fl&PF_TRIMTRAILINGSPACES);
+writer.insertFinalNewline = !!(fl&PF_INSERTFINALNEWLINE);
+writer.recordTrims = fixBuffer;
+bool ok = !!fd;
+for (int pos=0, len=str->size(), chunk=1048576, prc=-1; ok && pos<len; ) {
+ok = writer.write(str->data()+pos, min(chunk, len-pos));
+pos += min(chunk, len-pos);
+if (prc!=100*(long long)pos/len) {
+prc = 100*(long long)pos/len;
+RunAsync([=]()mutable{
+SetWindowText(sp->status, tsnprintf(512, msg("Saving %s... %d%%"), pageName.c_str(), prc));
+InvalidateStatusBar();
+});
+}}
+ok = ok && writer.finish();
+fd.close();
+auto trimmed = writer.trimmed;
+bool finalNewline = writer.finalNewlineAdded;
+RunAsync([=]()mutable{
+shared_ptr<Page> p = wp.lock();
+if (p) {
+p->flags &=~PF_SAVING;
+if (ok) {
+// Don't touch the buffer if it has been edited in the meantime
+if (fixBuffer && !p->IsModified()) {
+ApplySaveFixes(*p, trimmed, finalNewline);
+p->SetModified(false);
+}
+MarkFileSynchronized(*p);
+p->onsaved(p);
+}
+else p->SetModified(true);
+if (IsWindowVisible(p->zone)) p->UpdateStatusBar(sp->status);
+}
+if (!ok) MessageBox(sp->win, tsnprintf(512, msg("Couldn't save %s"), pageName.c_str()).c_str(), msg("Error").c_str(), MB_OK | MB_ICONERROR);
+});
+}, TASK_HIGH);
+return true;
+}
+
+void Page::WaitForSave () {
+if (!saveTask) return;
+// The UI thread keeps serving the procs and messages other threads are waiting for, and repainting, instead of blocking until the file is written
+if (IsUIThread()) while (!saveTask.Wait(15)) {
+MSG m;
+PeekMessage(&m, NULL, 0, 0, PM_NOREMOVE); // Delivers messages sent from other threads
+while (PeekMessage(&m, NULL, WM_PAINT, WM_PAINT, PM_REMOVE)) DispatchMessage(&m);
+RunUIQueue();
+}
+else saveTask.Wait();
+saveTask = Task();
+}
+
+bool Page::Save (bool saveAs, bool async) {
 if (saveAs || file.size()<=0 || (flags&PF_MUSTSAVEAS)) {
 tstring newFile = FileDialog(sp->win, FD_SAVE, file, msg("Save as") );
 if (newFile.size()<=0) return false;
-if (!SaveFile(newFile)) return false;
+if (!SaveFile(newFile, async)) return false;
 }
-else if (!SaveFile()) return false;
-onsaved(shared_from_this());
+else if (!SaveFile(TEXT(""), async)) return false;
+if (!(flags&PF_SAVING)) onsaved(shared_from_this());
 return true;
 }
 
+static bool LoadFileData (Page& p, File& fd, bool guessFormat) {
+boost::string_ref data = fd.view();
+p.tailCarry.clear();
+if (data.size()>0) {
+p.tailOffset = data.size();
+return p.LoadData(data.data(), data.size(), guessFormat);
+}
+string str = fd.readFully();
+p.tailOffset = str.size();
+return p.LoadData(str, guessFormat);
+}
+
+// Settings the format of a file falls back to, read from the configuration beforehand so that files can be decoded on any thread
+struct FormatDefaults {
+int encoding, lineEnding, indentationMode, tabWidth, editorConfigOverride;
+FormatDefaults ():
+encoding(sp->config->get("defaultEncoding", (int)GetACP())),
+lineEnding(sp->config->get("defaultLineEnding", LE_DOS)),
+indentationMode(sp->config->get("defaultIndentationMode", 0)),
+tabWidth(sp->config->get("defaultTabWidth", 4)),
+editorConfigOverride(sp->config->get("editorConfigOverride", 1))
+{}
+};
+
+// Content and format of a file read in the background, set to its page on the UI thread
+struct LoadedFile {
+tstring file, text;
+int error = 0, encoding = -1, lineEnding = -1, indentationMode = -1, tabWidth = -3;
+unsigned long long flags = 0, size = 0;
+IniFile editorConfig;
+FormatDefaults defaults;
+shared_ptr<SessionEntry> known;
+string data; // Left to decode on the UI thread
+bool decoded = false;
+};
+
+#define PF_EDITORCONFIG (PF_NOAUTOINDENT | PF_AUTOLINEBREAK | PF_NOSMARTHOME | PF_NOSAFEINDENT | PF_NOSMARTPASTE | PF_TRIMTRAILINGSPACES | PF_INSERTFINALNEWLINE | PF_FIXBUFFERONSAVE)
+
+// The following apply either to a page or to a LoadedFile
+template<class T> static void PresetEditorConfigFormat (T& p, IniFile& ini, const FormatDefaults& d) {
+p.lineEnding = elt(to_upper_copy(ini.get("end_of_line",string("0"))), d.lineEnding, {"CRLF", "LF", "CR", "RS", "LS"});
+p.encoding = eltm(to_lower_copy(ini.get("charset",string("0"))), d.encoding, {{"latin1", 1252}, {"latin-1", 1252}, {"utf-8", 65001}, {"utf8", 65001}, {"utf-16le", 1200}, {"utf-16be", 1201}, {"utf-8-bom", 65002}});
+p.indentationMode = elt(to_lower_copy(ini.get("indent_style",string("0"))), d.indentationMode, {"tab", "space"});
+if (p.indentationMode) p.indentationMode = ini.get("indent_size", p.indentationMode);
+p.tabWidth = ini.get("tab_width", ini.get("indent_size", p.indentationMode));
+}
+
+template<class T> static void ApplyEditorConfigFormat (T& p, IniFile& ini) {
+p.lineEnding = elt(to_upper_copy(ini.get("end_of_line",string("0"))), p.lineEnding, {"CRLF", "LF", "CR", "RS", "LS"});
+p.encoding = eltm(to_lower_copy(ini.get("charset",string("0"))), p.encoding, {{"latin1", 1252}, {"latin-1", 1252}, {"utf-8", 65001}, {"utf8", 65001}, {"utf-16le", 1200}, {"utf-16be", 1201}, {"utf-8-bom", 65002}});
+p.indentationMode = elt(to_lower_copy(ini.get("indent_style",string("0"))), p.indentationMode, {"tab", "space"});
+if (p.indentationMode) p.indentationMode = ini.get("indent_size", p.indentationMode);
+p.tabWidth = ini.get("tab_width", ini.get("indent_size", p.indentationMode));
+if (!ini.get("_6p_auto_indent", true)) p.flags |= PF_NOAUTOINDENT;
+if (ini.get("_6p_auto_line_break", false)) p.flags |= PF_AUTOLINEBREAK;
+if (!ini.get("_6p_smart_home", true)) p.flags |= PF_NOSMARTHOME;
+if (!ini.get("_6p_safe_indent", true)) p.flags |= PF_NOSAFEINDENT;
+if (!ini.get("_6p_smart_paste", true)) p.flags |= PF_NOSMARTPASTE;
+SetEditorConfigFlags(p, ini);
+}
+
+// Guesses what is still unknown of the format, i.e. -1, and converts the data to text with CRLF line endings
+template<class T> static tstring DecodeText (T& p, const char* data, int len, const FormatDefaults& d) {
+if (p.encoding<0) p.encoding = guessEncoding( (const unsigned char*)data, len, d.encoding);
+tstring text = ConvertFromEncoding(data, len, p.encoding);
+if (p.lineEnding<0) p.lineEnding = guessLineEnding(text.data(), text.size(), d.lineEnding);
+if (p.lineEnding==LE_UNIX) text = replace_all_copy(text, TEXT("\n"), TEXT("\r\n"));
+else if (p.lineEnding==LE_MAC) text = replace_all_copy(text, TEXT("\r"), TEXT("\r\n"));
+else if (p.lineEnding==LE_RS) text = replace_all_copy(text, TEXT("\x1E"), TEXT("\r\n"));
+else if (p.lineEnding==LE_LS) {
+text = replace_all_copy(text, TEXT("\x2028"), TEXT("\r\n"));
+text = replace_all_copy(text, TEXT("\x2029"), TEXT("\r\n\r\n"));
+}
+if (p.indentationMode<0) p.indentationMode = guessIndentationMode(text.data(), text.size(), d.indentationMode);
+if (p.indentationMode>0) p.tabWidth = p.indentationMode;
+else p.tabWidth = d.tabWidth;
+return text;
+}
+
+static void DecodeLoadedFile (LoadedFile& lf, const char* data, int len) {
+lf.text = DecodeText(lf, data, len, lf.defaults);
+if (lf.known) lf.tabWidth = lf.known->tabWidth;
+if (lf.defaults.editorConfigOverride>=1) ApplyEditorConfigFormat(lf, lf.editorConfig);
+lf.decoded = true;
+}
+
+// Same as Page::LoadFile, without touching the page
+static void ReadLoadedFile (LoadedFile& lf) {
+File fd(lf.file);
+if (!fd) {
+lf.error = GetLastError();
+return;
+}
+const FormatDefaults& d = lf.defaults;
+if (d.editorConfigOverride>0) ReadDotEditorconfigs(lf.file, lf.editorConfig);
+if (d.editorConfigOverride==2) PresetEditorConfigFormat(lf, lf.editorConfig, d);
+boost::string_ref data = fd.view();
+string str;
+if (data.size()<=0) data = str = fd.readFully();
+lf.size = data.size();
+if (lf.known && !MatchesSessionEntry(*lf.known, lf.file, data.data(), data.size())) lf.known = nullptr;
+if (lf.known) {
+lf.encoding = lf.known->encoding;
+lf.lineEnding = lf.known->lineEnding;
+lf.indentationMode = lf.known->indentationMode;
+}
+if (lf.encoding<0) lf.encoding = guessEncoding( (const unsigned char*)data.data(), data.size(), d.encoding);
+// When the last session is reopened, Python may not be initialized yet
+if (IsPythonEncoding(lf.encoding) && !Py_IsInitialized()) lf.data.assign(data.data(), data.size());
+else DecodeLoadedFile(lf, data.data(), data.size());
+}
+
+static int SetLoadedFile (Page& p, LoadedFile& lf) {
+if (lf.error) return -lf.error;
+if (!lf.decoded) {
+DecodeLoadedFile(lf, lf.data.data(), lf.data.size());
+lf.data.clear();
+}
+p.encoding = lf.encoding;
+p.lineEnding = lf.lineEnding;
+p.indentationMode = lf.indentationMode;
+p.tabWidth = lf.tabWidth;
+// The page is already shown: tab stops and menus must follow
+p.SetEncoding(p.encoding);
+p.SetLineEnding(p.lineEnding);
+p.SetIndentationMode(p.indentationMode);
+p.SetTabWidth(p.tabWidth);
+p.flags = (p.flags&~PF_EDITORCONFIG) | (lf.flags&PF_EDITORCONFIG);
+p.dotEditorConfig.fusion(lf.editorConfig);
+p.tailCarry.clear();
+p.tailOffset = lf.size;
+optional<tstring> re = p.onload(p.shared_from_this(), lf.text);
+if (re) lf.text = *re;
+MarkFileSynchronized(p);
+p.SetText(lf.text);
+return 1;
+}
+
 int Page::LoadFile (const tstring& filename, bool guessFormat) {
 if (filename.size()<=0 && (flags&PF_NORELOAD)) return 0;
 if (filename.size()>0) file = filename;
@@ -468,42 +809,126 @@ if (file.size()<=0) return 0;
 name = FileNameToPageName(*this, file);
 File fd(file);
 if (!fd) return -GetLastError();
-int editorConfigOverride = (!guessFormat?0: sp->config->get("editorConfigOverride", 1));
-if (!guessFormat || editorConfigOverride<=0) return LoadData(fd.readFully(), guessFormat);
+FormatDefaults d;
+int editorConfigOverride = (!guessFormat?0: d.editorConfigOverride);
+if (!guessFormat || editorConfigOverride<=0) return LoadFileData(*this, fd, guessFormat);
 IniFile& ini = dotEditorConfig;
 ReadDotEditorconfigs(file, ini);
 if (editorConfigOverride==2) {
-lineEnding = elt(to_upper_copy(ini.get("end_of_line",string("0"))), sp->config->get("defaultLineEnding", LE_DOS), {"CRLF", "LF", "CR", "RS", "LS"});
-encoding = eltm(to_lower_copy(ini.get("charset",string("0"))), sp->config->get("defaultEncoding", (int)GetACP()), {{"latin1", 1252}, {"latin-1", 1252}, {"utf-8", 65001}, {"utf8", 65001}, {"utf-16le", 1200}, {"utf-16be", 1201}, {"utf-8-bom", 65002}});
-indentationMode = elt(to_lower_copy(ini.get("indent_style",string("0"))), sp->config->get("defaultIndentationMode", 0), {"tab", "space"});
-if (indentationMode) indentationMode = ini.get("indent_size", indentationMode);
-tabWidth = ini.get("tab_width", ini.get("indent_size", indentationMode));
+PresetEditorConfigFormat(*this, ini, d);
 guessFormat=false;
 }
-auto result = LoadData(fd.readFully(), guessFormat);
-if (editorConfigOverride>=1) {
-lineEnding = elt(to_upper_copy(ini.get("end_of_line",string("0"))), lineEnding, {"CRLF", "LF", "CR", "RS", "LS"});
-encoding = eltm(to_lower_copy(ini.get("charset",string("0"))), encoding, {{"latin1", 1252}, {"latin-1", 1252}, {"utf-8", 65001}, {"utf8", 65001}, {"utf-16le", 1200}, {"utf-16be", 1201}, {"utf-8-bom", 65002}});
-indentationMode = elt(to_lower_copy(ini.get("indent_style",string("0"))), indentationMode, {"tab", "space"});
-if (indentationMode) indentationMode = ini.get("indent_size", indentationMode);
-tabWidth = ini.get("tab_width", ini.get("indent_size", indentationMode));
-if (!ini.get("_6p_auto_indent", true)) flags |= PF_NOAUTOINDENT;
-if (ini.get("_6p_auto_line_break", false)) flags |= PF_AUTOLINEBREAK;
-if (!ini.get("_6p_smart_home", true)) flags |= PF_NOSMARTHOME;
-if (!ini.get("_6p_safe_indent", true)) flags |= PF_NOSAFEINDENT;
-if (!ini.get("_6p_smart_paste", true)) flags |= PF_NOSMARTPASTE;
-bool trimEol = ini.get("trim_trailing_whitespace", false); //todo: flag this setting
-bool eofNewline = ini.get("insert_final_newline", false); //todo: flag this setting
-}
+auto result = LoadFileData(*this, fd, guessFormat);
+if (editorConfigOverride>=1) ApplyEditorConfigFormat(*this, ini);
 return result;
 }
 
-bool Page::LoadData (const string& str, bool guessFormat) {
-tstring text = TEXT("");
+Task Page::LoadFileInBackground (int priority, const function<void(Page&,int)>& done, const SessionEntry* known) {
+if (file.size()<=0) {
+if (done) done(*this, 0);
+return Task();
+}
+name = FileNameToPageName(*this, file);
+auto lf = make_shared<LoadedFile>();
+lf->file = file;
+lf->flags = flags;
+if (known) lf->known = make_shared<SessionEntry>(*known);
+bool readOnly = IsReadOnly();
+SetReadOnly(true);
+flags |= PF_LOADING;
+weak_ptr<Page> wp = shared_from_this();
+return SubmitTask([=]()mutable{
+ReadLoadedFile(*lf);
+RunAsync([=]()mutable{
+shared_ptr<Page> p = wp.lock();
+if (!p) return;
+p->SetReadOnly(readOnly);
+p->flags &= ~PF_LOADING;
+// Text recovered meanwhile isn't replaced
+int re = p->IsModified()? 0 : SetLoadedFile(*p, *lf);
+if (done) done(*p, re);
+});
+}, priority);
+}
+
+bool Page::LoadData (const char* data, int len, bool guessFormat) {
 if (guessFormat) { encoding=-1; lineEnding=-1; indentationMode=-1; tabWidth=-3; }
-if (encoding<0) encoding = guessEncoding( (const unsigned char*)(str.data()), str.size(), sp->config->get("defaultEncoding", (int)GetACP()) );
-text = ConvertFromEncoding(str, encoding);
-if (lineEnding<0) lineEnding = guessLineEnding(text.data(), text.size(), sp->config->get("defaultLineEnding", LE_DOS)  );
+tstring text = DecodeText(*this, data, len, FormatDefaults());
+optional<tstring> re = onload(shared_from_this(), text);
+if (re) text = *re;
+MarkFileSynchronized(*this);
+SetText(text);
+return true;
+}
+
+bool Page::CheckFileModification () {
+return !!(flags&PF_CHANGEDONDISK);
+}
+
+void Page::OnFileChangedOnDisk (unsigned long long lastModified) {
+if (lastSave<=0 || lastModified<=lastSave || (flags&PF_SAVING)) return;
+if ((flags&PF_TAIL) && ReadAppendedData()) return;
+flags |= PF_CHANGEDONDISK;
+onfileChanged(shared_from_this());
+}
+
+static int IncompleteTrailingBytes (const string& s, int encoding) {
+int n = s.size();
+switch(encoding){
+case CP_UTF8:
+case CP_UTF8_BOM: {
+int i = n -1;
+while (i>=0 && i>=n -3 && (s[i]&0xC0)==0x80) i--;
+if (i<0) return 0;
+unsigned char c = s[i];
+int needed = c>=0xF0? 4 : c>=0xE0? 3 : c>=0xC0? 2 : 1;
+return n-i<needed? n-i : 0;
+}
+case CP_UTF16_LE:
+case CP_UTF16_LE_BOM:
+case CP_UTF16_BE:
+case CP_UTF16_BE_BOM: {
+int r = n%2;
+if (n-r<2) return r;
+bool le = encoding==CP_UTF16_LE || encoding==CP_UTF16_LE_BOM;
+unsigned int w = le? (unsigned char)s[n-r-2] | ((unsigned char)s[n-r-1]<<8) : ((unsigned char)s[n-r-2]<<8) | (unsigned char)s[n-r-1];
+return r + (w>=0xD800 && w<0xDC00? 2 : 0); // Keep an high surrogate for the next read
+}
+case CP_UTF32_LE_BOM:
+case CP_UTF32_BE_BOM:
+return n%4;
+default: return 0;
+}}
+
+bool Page::ReadAppendedData () {
+if (file.size()<=0) return false;
+File fd(file);
+if (!fd) return false;
+long long size = fd.io->size();
+if (size<0) return false;
+else if (size<tailOffset) { // Truncated or rotated file
+LoadFile(TEXT(""), false);
+return true;
+}
+else if (size==tailOffset) return true;
+else if (!fd.seek(tailOffset)) return false;
+// The signature is prepended so that the decoder skips it, as when loading the whole file
+string sig = GetEncodingSignature(encoding), data = sig + tailCarry;
+int pos = data.size(), n;
+data.resize(pos + size - tailOffset);
+while (pos<data.size() && (n = fd.read(&data[pos], data.size() -pos))>0) pos+=n;
+data.resize(pos);
+tailOffset += pos - sig.size() - tailCarry.size();
+int incomplete = IncompleteTrailingBytes(data, encoding);
+tailCarry = data.substr(data.size() -incomplete);
+data.resize(data.size() -incomplete);
+tstring text = ConvertFromEncoding(data, encoding);
+if (lineEnding==LE_DOS && text.size()>0 && text[text.size() -1]=='\r') { // Don't split a CRLF in two
+string cr;
+AppendEncodedText(cr, TEXT("\r"), 1, encoding);
+tailCarry = cr + tailCarry;
+text.erase(text.size() -1);
+}
 if (lineEnding==LE_UNIX) text = replace_all_copy(text, TEXT("\n"), TEXT("\r\n"));
 else if (lineEnding==LE_MAC) text = replace_all_copy(text, TEXT("\r"), TEXT("\r\n"));
 else if (lineEnding==LE_RS) text = replace_all_copy(text, TEXT("\x1E"), TEXT("\r\n"));
@@ -511,43 +936,158 @@ else if (lineEnding==LE_LS) {
 text = replace_all_copy(text, TEXT("\x2028"), TEXT("\r\n"));
 text = replace_all_copy(text, TEXT("\x2029"), TEXT("\r\n\r\n"));
 }
-if (indentationMode<0) indentationMode = guessIndentationMode(text.data(), text.size(), sp->config->get("defaultIndentationMode", 0)  );
-if (indentationMode>0) tabWidth = indentationMode;
-else tabWidth = sp->config->get("defaultTabWidth", 4);
-optional<tstring> re = onload(shared_from_this(), text);
-if (re) text = *re;
 lastSave = GetCurTime();
-SetText(text);
+flags &=~PF_CHANGEDONDISK;
+if (text.size()<=0) return true;
+bool modified = IsModified();
+int start, end, len = GetTextLength(), firstLine = SendMessage(zone, EM_GETFIRSTVISIBLELINE, 0, 0);
+GetSelection(start, end);
+bool follow = !!(flags&PF_TAILFOLLOW);
+if (!follow) SendMessage(zone, WM_SETREDRAW, FALSE, 0);
+SendMessage(zone, EM_SETSEL, len, len);
+SendMessage(zone, EM_REPLACESEL, FALSE, text.c_str());
+editGeneration++;
+InvalidateStructureIndex(*this, len);
+InvalidateBracketIndex(*this, len);
+JournalTextChanged(*this);
+if (follow) SendMessage(zone, EM_SCROLLCARET, 0, 0);
+else {
+SendMessage(zone, EM_SETSEL, start, end);
+SendMessage(zone, EM_LINESCROLL, 0, firstLine - SendMessage(zone, EM_GETFIRSTVISIBLELINE, 0, 0));
+SendMessage(zone, WM_SETREDRAW, TRUE, 0);
+InvalidateRect(zone, NULL, TRUE);
+}
+SetModified(modified);
 return true;
 }
 
-bool Page::CheckFileModification () {
-if (file.size()<=0) return false;
-unsigned long long lastMod = GetFileTime(file.c_str(), LAST_MODIFIED_TIME);
-return lastMod>0 && lastSave>0 && lastMod>lastSave;
+void Page::SetTail (bool tail) {
+if (tailTimer) sp->ClearTimeout(tailTimer);
+tailTimer = 0;
+if (!tail) { flags&=~PF_TAIL; return; }
+flags |= PF_TAIL;
+ReadAppendedData();
+// Change notifications are enough for local files, but may be unreliable on network shares
+int interval = sp->config->get("tailInterval", 0);
+if (interval<=0) return;
+weak_ptr<Page> wp = shared_from_this();
+tailTimer = sp->SetTimeout([=](){
+shared_ptr<Page> p = wp.lock();
+if (p) p->ReadAppendedData();
+}, interval, true);
+}
+
+#define STATUSBAR_DELAY 16
+
+// What the status bar currently shows; line and column are tracked from the previous caret position as long as the text isn't modified
+struct StatusBarModel {
+weak_ptr<Page> page, pending;
+HWND status = NULL;
+int timer = 0, selStart = -1, selEnd = -1, line = 0, lineStart = 0, lineEnd = -1, lines = 0, length = 0;
+unsigned int generation = 0;
+tstring text;
+int updates = 0, skipped = 0;
+long long lastTime = 0, totalTime = 0;
+};
+static StatusBarModel statusBar;
+
+static void StatusBarLocate (StatusBarModel& m, HWND hEdit, int pos) {
+if (m.lineEnd>=0 && pos>=m.lineStart && pos<=m.lineEnd) return;
+// Moving to the next or previous line is the most common case
+int start = -1;
+if (m.lineEnd>=0 && pos>m.lineEnd && m.line+1<m.lines) start = SendMessage(hEdit, EM_LINEINDEX, m.line+1, 0);
+else if (m.lineEnd>=0 && pos<m.lineStart && m.line>0) start = SendMessage(hEdit, EM_LINEINDEX, m.line -1, 0);
+if (start>=0 && pos>=start) {
+int end = start + SendMessage(hEdit, EM_LINELENGTH, start, 0);
+if (pos<=end) {
+m.line += (start>m.lineStart? 1 : -1);
+m.lineStart = start;
+m.lineEnd = end;
+return;
+}}
+m.line = SendMessage(hEdit, EM_LINEFROMCHAR, pos, 0);
+m.lineStart = SendMessage(hEdit, EM_LINEINDEX, m.line, 0);
+m.lineEnd = m.lineStart + SendMessage(hEdit, EM_LINELENGTH, m.lineStart, 0);
 }
 
-static tstring StatusBarUpdate (HWND hEdit, HWND status, Page* p) {
-int spos=-1, epos=-1;
+// Returns false if nothing changed since the last update
+static bool StatusBarTrack (StatusBarModel& m, Page& p) {
+HWND hEdit = p.zone;
+int spos=-1, epos=-1, length = GetWindowTextLength(hEdit);
 SendMessage(hEdit, EM_GETSEL, &spos, &epos);
-int sline = SendMessage(hEdit, EM_LINEFROMCHAR, spos, 0);
-int scolumn = spos - SendMessage(hEdit, EM_LINEINDEX, sline, 0);
+if (m.page.lock().get()!=&p || m.generation!=p.editGeneration || m.length!=length) {
+m.page = p.shared_from_this();
+m.generation = p.editGeneration;
+m.length = length;
+m.lines = SendMessage(hEdit, EM_GETLINECOUNT, 0, 0);
+m.lineEnd = -1;
+}
+else if (spos==m.selStart && epos==m.selEnd) return false;
+m.selStart = spos;
+m.selEnd = epos;
+StatusBarLocate(m, hEdit, spos);
+return true;
+}
+
+static tstring StatusBarText (StatusBarModel& m, HWND hEdit) {
+int spos = m.selStart, epos = m.selEnd;
+int sline = m.line, scolumn = spos - m.lineStart;
 if (spos!=epos) {
 int eline = SendMessage(hEdit, EM_LINEFROMCHAR, epos, 0);
 int ecolumn = epos - SendMessage(hEdit, EM_LINEINDEX, eline, 0);
 return tsnprintf(512, msg("Li %d, Col %d to Li %d, Col %d"), 1+sline, 1+scolumn, 1+eline, 1+ecolumn);
 } else {
-int nlines = SendMessage(hEdit, EM_GETLINECOUNT, 0, 0);
-int max = GetWindowTextLength(hEdit);
-int prc = max? 100 * spos / max :0;
-return tsnprintf(512, msg("Li %d, Col %d.\t%d%%, %d lines"), 1+sline, 1+scolumn, prc, nlines);
+int prc = m.length? 100 * spos / m.length :0;
+return tsnprintf(512, msg("Li %d, Col %d.\t%d%%, %d lines"), 1+sline, 1+scolumn, prc, m.lines);
 }}
 
-void Page::UpdateStatusBar (HWND hStatus) {
-tstring text = StatusBarUpdate(zone, hStatus, this);
-optional<tstring> re = onstatus(shared_from_this(), text);
+static void StatusBarRefresh () {
+StatusBarModel& m = statusBar;
+m.timer = 0;
+shared_ptr<Page> p = m.pending.lock();
+m.pending.reset();
+if (!p || !p->zone) return;
+LARGE_INTEGER start, end;
+QueryPerformanceCounter(&start);
+bool changed = StatusBarTrack(m, *p);
+if (changed || !p->onstatus.empty()) {
+tstring text = StatusBarText(m, p->zone);
+optional<tstring> re = p->onstatus(p, text);
 if (re) text = *re;
-SetWindowText(hStatus, text);
+if (text!=m.text) {
+SetWindowText(m.status, text);
+m.text = text;
+changed = true;
+}
+else changed = false;
+}
+QueryPerformanceCounter(&end);
+m.lastTime = end.QuadPart - start.QuadPart;
+m.totalTime += m.lastTime;
+m.updates++;
+if (!changed) m.skipped++;
+}
+
+void Page::UpdateStatusBar (HWND hStatus) {
+// Refreshes are coalesced, so that the status bar is updated at most once per frame
+statusBar.status = hStatus;
+statusBar.pending = shared_from_this();
+if (!statusBar.timer) statusBar.timer = sp->SetTimeout(StatusBarRefresh, STATUSBAR_DELAY, false);
+}
+
+void export InvalidateStatusBar () {
+StatusBarModel& m = statusBar;
+m.page.reset();
+m.selStart = m.selEnd = -1;
+m.lineEnd = -1;
+m.text.clear();
+}
+
+std::tuple<int,int,double,double> export GetStatusBarStatistics () {
+LARGE_INTEGER freq;
+QueryPerformanceFrequency(&freq);
+double us = 1000000.0 / freq.QuadPart;
+return std::make_tuple(statusBar.updates, statusBar.skipped, statusBar.lastTime * us, statusBar.updates? statusBar.totalTime * us / statusBar.updates : 0.0);
 }
 
 static INT_PTR CALLBACK GoToLineDlgProc (HWND hwnd, UINT umsg, WPARAM wp, LPARAM lp) {
@@ -587,6 +1127,20 @@ void Page::GoToDialog () {
 DialogBoxParam(dllHinstance, IDD_GOTOLINE, sp->win, GoToLineDlgProc, this);
 }
 
+void Page::GoToMatchingBracket () {
+int pos = FindMatchingBracket(*this, GetCurrentPosition());
+if (pos<0) MessageBeep(MB_OK);
+else SetCurrentPosition(pos);
+}
+
+void Page::SelectToMatchingBracket () {
+int bracket, pos = FindMatchingBracket(*this, GetCurrentPosition(), &bracket);
+if (pos<0) { MessageBeep(MB_OK); return; }
+// Both brackets are included in the selection
+if (pos>bracket) SetSelection(bracket, pos+1);
+else SetSelection(bracket+1, pos);
+}
+
 static INT_PTR CALLBACK FindReplaceDlgProc (HWND hwnd, UINT umsg, WPARAM wp, LPARAM lp) {
 static Page* page = 0;
 switch (umsg) {
@@ -657,88 +1211,6 @@ void Page::FindReplaceDialog () {
 FindReplaceDlg2(*this,true);
 }
 
-static int EZGetNextParagPos (HWND hEdit, int pos) {
-int nl=0, len = GetWindowTextLength(hEdit);
-HLOCAL hLoc = (HLOCAL)SendMessage(hEdit, EM_GETHANDLE, 0, 0);
-LPCTSTR text = (LPCTSTR)LocalLock(hLoc);
-while(pos<len) {
-TCHAR c = text[pos++];
-if (c=='\n' && ++nl>=2) break;
-else if (c>32) nl=0;
-}
-for (int i=pos; i<len && text[i]<=32; i++) if (text[i]=='\n') pos=i+1;
-LocalUnlock(hLoc);
-return pos;
-}
-
-static int EZGetPrevParagPos (HWND hEdit, int pos) {
-int nl=0, realBegPos=pos;
-HLOCAL hLoc = (HLOCAL)SendMessage(hEdit, EM_GETHANDLE, 0, 0);
-LPCTSTR text = (LPCTSTR)LocalLock(hLoc);
-while (pos>0 && text[--pos]<=32);
-while(pos>0) {
-TCHAR c = text[--pos];
-if (c=='\n' && ++nl>=2) break;
-else if (c>32) { nl=0; realBegPos=pos; }
-}
-LocalUnlock(hLoc);
-return realBegPos;
-}
-
-static int EZGetNextBracketPos (HWND hEdit, int pos) {
-int len = GetWindowTextLength(hEdit);
-HLOCAL hLoc = (HLOCAL)SendMessage(hEdit, EM_GETHANDLE, 0, 0);
-LPCTSTR text = (LPCTSTR)LocalLock(hLoc);
-pos++;
-while(pos<len) {
-if (text[pos++]=='}' && (text[pos]=='\n' || text[pos]=='\r')) break;
-}
-LocalUnlock(hLoc);
-return pos;
-}
-
-static int EZGetPrevBracketPos (HWND hEdit, int pos) {
-int len = GetWindowTextLength(hEdit);
-HLOCAL hLoc = (HLOCAL)SendMessage(hEdit, EM_GETHANDLE, 0, 0);
-LPCTSTR text = (LPCTSTR)LocalLock(hLoc);
-while(pos>0) {
-if (text[--pos]=='{' && (text[pos+1]=='\n' || text[pos+1]=='\r')) break;
-}
-LocalUnlock(hLoc);
-return pos;
-}
-
-static int EZGetEndIndentedBlockPos (HWND hEdit, int pos) {
-int ln = SendMessage(hEdit, EM_LINEFROMCHAR, pos, 0), maxline = SendMessage(hEdit, EM_GETLINECOUNT, 0, 0), maxpos = GetWindowTextLength(hEdit);
-tstring indent = EditGetLine(hEdit, ln, pos);
-int n = indent.find_first_not_of(TEXT("\t \xA0"));
-if (n<0 || n>=indent.size()) n=indent.size();
-indent = indent.substr(0,n);
-while(++ln<maxline) {
-tstring line = EditGetLine(hEdit, ln);
-if (!starts_with(line, indent)) break;
-}
-n = SendMessage(hEdit, EM_LINEINDEX, ln -1, 0);
-n +=  SendMessage(hEdit, EM_LINELENGTH, n, 0);
-if (pos==n && n<maxpos -2) return EZGetEndIndentedBlockPos(hEdit, pos+2);
-return n;
-}
-
-static int EZGetStartIndentedBlockPos (HWND hEdit, int pos) {
-int ln = SendMessage(hEdit, EM_LINEFROMCHAR, pos, 0);
-tstring indent = EditGetLine(hEdit, ln, pos);
-int n = indent.find_first_not_of(TEXT("\t \xA0"));
-if (n<0 || n>=indent.size()) n=indent.size();
-indent = indent.substr(0,n);
-while(--ln>=0) {
-tstring line = EditGetLine(hEdit, ln);
-if (!starts_with(line, indent)) break;
-}
-n = SendMessage(hEdit, EM_LINEINDEX, ln+1, 0);
-if (pos>=n && pos<=n+indent.size() && n>2) return EZGetStartIndentedBlockPos(hEdit, n -2);
-return n;
-}
-
 static void EZTextInserted (Page* curPage, HWND hwnd, const tstring& text, bool tryToJoin = true) {
 int selStart, selEnd;
 SendMessage(hwnd, EM_GETSEL, &selStart, &selEnd);
@@ -853,36 +1325,36 @@ SendMessage(hEdit, EM_SETSEL, ss, offset+se);
 return true;
 }
 
-template<class F> static LRESULT EZHandleMoveDown (HWND hEdit, const F& f, bool moveHome=true) {
+template<class F> static LRESULT EZHandleMoveDown (Page* curPage, HWND hEdit, const F& f, bool moveHome=true) {
 int pos=0;
 SendMessage(hEdit, EM_GETSEL, 0, &pos);
-pos = f(hEdit, pos);
+pos = f(*curPage, pos);
 SendMessage(hEdit, EM_SETSEL, pos, pos);
 if (moveHome) return EZHandleHome(hEdit, false);
 else return true;
 }
 
-template <class F> static LRESULT EZHandleMoveUp (HWND hEdit, const F& f, bool moveHome=true) {
+template <class F> static LRESULT EZHandleMoveUp (Page* curPage, HWND hEdit, const F& f, bool moveHome=true) {
 int pos=0;
 SendMessage(hEdit, EM_GETSEL, 0, &pos);
-pos = f(hEdit, pos);
+pos = f(*curPage, pos);
 SendMessage(hEdit, EM_SETSEL, pos, pos);
 if (moveHome) return EZHandleHome(hEdit, false);
 else return true;
 }
 
-template <class F> static LRESULT EZHandleSelectDown (HWND hEdit, const F& f) {
+template <class F> static LRESULT EZHandleSelectDown (Page* curPage, HWND hEdit, const F& f) {
 int spos=0, pos=0;
 SendMessage(hEdit, EM_GETSEL, &spos, &pos);
-pos = f(hEdit, pos);
+pos = f(*curPage, pos);
 SendMessage(hEdit, EM_SETSEL, spos, pos);
 return true;
 }
 
-template <class F> static LRESULT EZHandleSelectUp (HWND hEdit, const F& f) {
+template <class F> static LRESULT EZHandleSelectUp (Page* curPage, HWND hEdit, const F& f) {
 int spos=0, pos=0;
 SendMessage(hEdit, EM_GETSEL, &spos, &pos);
-pos = f(hEdit, pos);
+pos = f(*curPage, pos);
 SendMessage(hEdit, EM_SETSEL, spos, pos);
 return true;
 }
@@ -920,7 +1392,13 @@ if (curPage->indentationMode>0) for (int i=0; i<curPage->indentationMode; i++) S
 return curPage->indentationMode>0;
 }}}
 
-static LRESULT CALLBACK EditProc (HWND hwnd, UINT msg, WPARAM wp, LPARAM lp, UINT_PTR subclassId, Page* curPage) {
+// Within EditProc, edits are mostly recorded before the edit control applies them; the generation is only incremented and the indexes invalidated once it has, so that they can't be rebuilt from the old text in between and then taken as up to date
+static int editProcDepth = 0;
+static vector<tuple<weak_ptr<Page>, shared_ptr<UndoState>, bool>> deferredEdits;
+
+static void ApplyDeferredEdits ();
+
+static LRESULT HandleEditMessage (HWND hwnd, UINT msg, WPARAM wp, LPARAM lp, Page* curPage) {
 switch(msg){
 case WM_CHAR: {
 TCHAR cc = LOWORD(wp);
@@ -955,18 +1433,18 @@ case WM_KEYDOWN :  case WM_SYSKEYDOWN:  {
 int kc = LOWORD(wp) | GetCurrentModifiers();
 if (!curPage->onkeyDown(curPage->shared_from_this(), kc)) return true;
 switch(kc){
-case VK_DOWN | VKM_CTRL | VKM_SHIFT : return EZHandleSelectDown(hwnd, EZGetNextParagPos);
-case VK_DOWN | VKM_CTRL: return EZHandleMoveDown(hwnd, EZGetNextParagPos);
-case VK_DOWN | VKM_ALT | VKM_SHIFT: return EZHandleSelectDown(hwnd, EZGetNextBracketPos);
-case VK_DOWN | VKM_ALT: return EZHandleMoveDown(hwnd, EZGetNextBracketPos, false);
-case VK_UP | VKM_SHIFT | VKM_CTRL: return EZHandleSelectUp(hwnd, EZGetPrevParagPos);
-case VK_UP | VKM_CTRL: return EZHandleMoveUp(hwnd, EZGetPrevParagPos);
-case VK_UP | VKM_ALT | VKM_SHIFT: return EZHandleSelectUp(hwnd, EZGetPrevBracketPos);
-case VK_UP | VKM_ALT: return EZHandleMoveUp(hwnd, EZGetPrevBracketPos, false);
-case VK_LEFT | VKM_ALT | VKM_SHIFT: return EZHandleSelectUp(hwnd, EZGetStartIndentedBlockPos);
-case VK_LEFT | VKM_ALT: return EZHandleMoveUp(hwnd, EZGetStartIndentedBlockPos);
-case VK_RIGHT | VKM_ALT | VKM_SHIFT: return EZHandleSelectDown(hwnd, EZGetEndIndentedBlockPos);
-case VK_RIGHT | VKM_ALT: return EZHandleMoveDown(hwnd, EZGetEndIndentedBlockPos, false);
+case VK_DOWN | VKM_CTRL | VKM_SHIFT : return EZHandleSelectDown(curPage, hwnd, GetNextParagraphPosition);
+case VK_DOWN | VKM_CTRL: return EZHandleMoveDown(curPage, hwnd, GetNextParagraphPosition);
+case VK_DOWN | VKM_ALT | VKM_SHIFT: return EZHandleSelectDown(curPage, hwnd, GetNextBracketPosition);
+case VK_DOWN | VKM_ALT: return EZHandleMoveDown(curPage, hwnd, GetNextBracketPosition, false);
+case VK_UP | VKM_SHIFT | VKM_CTRL: return EZHandleSelectUp(curPage, hwnd, GetPreviousParagraphPosition);
+case VK_UP | VKM_CTRL: return EZHandleMoveUp(curPage, hwnd, GetPreviousParagraphPosition);
+case VK_UP | VKM_ALT | VKM_SHIFT: return EZHandleSelectUp(curPage, hwnd, GetPreviousBracketPosition);
+case VK_UP | VKM_ALT: return EZHandleMoveUp(curPage, hwnd, GetPreviousBracketPosition, false);
+case VK_LEFT | VKM_ALT | VKM_SHIFT: return EZHandleSelectUp(curPage, hwnd, GetIndentedBlockStart);
+case VK_LEFT | VKM_ALT: return EZHandleMoveUp(curPage, hwnd, GetIndentedBlockStart);
+case VK_RIGHT | VKM_ALT | VKM_SHIFT: return EZHandleSelectDown(curPage, hwnd, GetIndentedBlockEnd);
+case VK_RIGHT | VKM_ALT: return EZHandleMoveDown(curPage, hwnd, GetIndentedBlockEnd, false);
 case VK_HOME: return EZHandleHome(hwnd, curPage->flags&PF_NOSMARTHOME);
 case VK_HOME | VKM_ALT: return EZHandleHome(hwnd, true);
 case VK_HOME | VKM_SHIFT: if (EZHandleShiftHome(hwnd, curPage->flags&PF_NOSMARTHOME)) return true; break;
@@ -1033,6 +1511,13 @@ case WM_UNDO: case EM_UNDO: curPage->Undo(); return true;
 return DefSubclassProc(hwnd, msg, wp, lp);
 }
 
+static LRESULT CALLBACK EditProc (HWND hwnd, UINT msg, WPARAM wp, LPARAM lp, UINT_PTR subclassId, Page* curPage) {
+editProcDepth++;
+LRESULT re = HandleEditMessage(hwnd, msg, wp, lp, curPage);
+if (--editProcDepth==0 && !deferredEdits.empty()) ApplyDeferredEdits();
+return re;
+}
+
 void Page::CreateZone (HWND parent, bool subclass) {
 static int count = 0;
 tstring text;
@@ -1133,7 +1618,61 @@ text = join(lines, TEXT("\n"));
 page->SetText(text);
 }
 
+static void TextEdited (Page& p, int pos, int deleted, const tstring& inserted) {
+InvalidateStructureIndex(p, pos);
+InvalidateBracketIndex(p, pos);
+p.textSnapshot.reset();
+JournalEdit(p, pos, deleted, inserted);
+}
+
+static void TrackUndoState (Page& p, UndoState& u, bool undo) {
+switch(u.GetTypeId()){
+case 1: {
+TextInserted& s = static_cast<TextInserted&>(u);
+if (undo) TextEdited(p, s.pos, s.text.size(), TEXT(""));
+else TextEdited(p, s.pos, 0, s.text);
+}break;
+case 2: {
+TextDeleted& s = static_cast<TextDeleted&>(u);
+if (undo) TextEdited(p, s.start, 0, s.text);
+else TextEdited(p, s.start, s.end-s.start, TEXT(""));
+}break;
+case 3: {
+TextReplaced& s = static_cast<TextReplaced&>(u);
+if (undo) TextEdited(p, s.pos, s.newText.size(), s.oldText);
+else TextEdited(p, s.pos, s.oldText.size(), s.newText);
+}break;
+case 4: {
+// Applied backwards and reverted forwards, so that the original positions stay valid
+TextEditsApplied& s = static_cast<TextEditsApplied&>(u);
+if (s.wholeText) break; // Indexes are rebuilt and the text journaled as a whole anyway
+if (undo) for (int i=0; i<s.edits.size(); i++) TextEdited(p, s.edits[i].start, s.edits[i].newText.size(), s.edits[i].oldText);
+else for (int i=s.edits.size() -1; i>=0; i--) TextEdited(p, s.edits[i].start, s.edits[i].oldText.size(), s.edits[i].newText);
+}break;
+default: JournalTextChanged(p); break;
+}}
+
+static void EditApplied (Page& p, const shared_ptr<UndoState>& u, bool undo) {
+if (editProcDepth>0) {
+deferredEdits.push_back(make_tuple(p.shared_from_this(), u, undo));
+return;
+}
+p.editGeneration++;
+TrackUndoState(p, *u, undo);
+}
+
+static void ApplyDeferredEdits () {
+vector<tuple<weak_ptr<Page>, shared_ptr<UndoState>, bool>> edits;
+edits.swap(deferredEdits);
+for (auto& e: edits) {
+shared_ptr<Page> p = get<0>(e).lock();
+if (!p) continue;
+p->editGeneration++;
+TrackUndoState(*p, *get<1>(e), get<2>(e));
+}}
+
 void Page::PushUndoState (shared_ptr<UndoState> u, bool tryToJoin) {
+EditApplied(*this, u, false);
 if (curUndoState<undoStates.size()) undoStates.erase(undoStates.begin() + curUndoState, undoStates.end() );
 if (tryToJoin && curUndoState>0 && curUndoState<=undoStates.size() && undoStates[curUndoState -1]->Join(*u)) return;
 if (undoStates.size()>=50) undoStates.erase(undoStates.begin());
@@ -1147,6 +1686,7 @@ MessageBeep(MB_OK);
 return;
 }
 undoStates[--curUndoState]->Undo(*this);
+EditApplied(*this, undoStates[curUndoState], true);
 }
 
 void Page::Redo () {
@@ -1155,6 +1695,7 @@ MessageBeep(MB_OK);
 return;
 }
 undoStates[curUndoState++]->Redo(*this);
+EditApplied(*this, undoStates[curUndoState -1], false);
 }
 
 void TextDeleted::Redo (Page& p) {
@@ -1224,27 +1765,135 @@ if (select) SendMessage(p.zone, EM_SETSEL, pos, pos+oldText.size());
 if (IsWindowVisible(p.zone)) SendMessage(p.zone, EM_SCROLLCARET, 0, 0);
 }
 
-unordered_map<int,connection> connections;
+int TextEditsApplied::MapPosition (int pos) {
+int delta = 0;
+for (TextEdit& e: edits) {
+if (e.start>=pos) break;
+int oldEnd = e.start + e.oldText.size();
+if (oldEnd>pos) return e.start + delta + min<int>(pos - e.start, e.newText.size());
+delta += e.newText.size() - e.oldText.size();
+}
+return pos+delta;
+}
+
+void TextEditsApplied::Apply (Page& p, bool undo) {
+vector<int> starts;
+int delta = 0;
+for (TextEdit& e: edits) {
+starts.push_back(undo? e.start+delta : e.start);
+delta += e.newText.size() - e.oldText.size();
+}
+wholeText = edits.size()>64;
+if (wholeText) { // Many small edits, rebuilding the text at once is faster than a lot of EM_REPLACESEL
+int len = p.GetTextLength(), last = 0;
+tstring text;
+text.reserve(len + (undo? -delta : delta));
+HLOCAL hLoc = (HLOCAL)SendMessage(p.zone, EM_GETHANDLE, 0, 0);
+LPCTSTR cur = (LPCTSTR)LocalLock(hLoc);
+for (int i=0; i<edits.size(); i++) {
+const tstring &from = undo? edits[i].newText : edits[i].oldText, &to = undo? edits[i].oldText : edits[i].newText;
+text.append(cur+last, cur+starts[i]);
+text += to;
+last = starts[i] + from.size();
+}
+text.append(cur+last, cur+len);
+LocalUnlock(hLoc);
+p.SetText(text);
+p.SetModified(true);
+return;
+}
+for (int i=edits.size() -1; i>=0; i--) {
+const tstring &from = undo? edits[i].newText : edits[i].oldText, &to = undo? edits[i].oldText : edits[i].newText;
+SendMessage(p.zone, EM_SETSEL, starts[i], starts[i]+from.size());
+SendMessage(p.zone, EM_REPLACESEL, 0, to.c_str());
+}
+if (IsWindowVisible(p.zone)) SendMessage(p.zone, EM_SCROLLCARET, 0, 0);
+}
+
+/* Connections handed out to Python are kept in a slot map: ids are made of the index of the entry and of a generation, incremented each time the entry is freed, so that a stale id never refers to a newer connection.
+Entries are freed when the event is removed, or when the signal is destroyed together with its page or dialog, which may happen on any thread.
+*/
+#define CONNECTION_INDEX_BITS 20
+
+struct ConnectionEntry {
+connection con;
+int generation, nextFree;
+bool used;
+};
+
+static CRITICAL_SECTION connectionsLock;
+static vector<ConnectionEntry> connections;
+static int firstFreeConnection = -1, connectionsAdded = 0, connectionsRemoved = 0, connectionsReleased = 0;
+static struct ConnectionsInit { ConnectionsInit () { InitializeCriticalSection(&connectionsLock); } } connectionsInit;
+
+static ConnectionEntry* FindConnectionEntry (int id) {
+int index = (id & ((1<<CONNECTION_INDEX_BITS) -1)) -1, generation = id>>CONNECTION_INDEX_BITS;
+if (index<0 || index>=connections.size() || !connections[index].used || connections[index].generation!=generation) return NULL;
+return &connections[index];
+}
+
+static void FreeConnectionEntry (ConnectionEntry& e) {
+e.con = connection();
+e.used = false;
+e.generation = (e.generation+1) & ((1<<(31-CONNECTION_INDEX_BITS)) -1);
+e.nextFree = firstFreeConnection;
+firstFreeConnection = &e - &connections[0];
+}
 
 int export AddSignalConnection (const connection& con) {
-for (auto it=connections.begin(); it!=connections.end(); ) {
-if (!it->second.connected()) connections.erase(it++);
-else ++it;
+shared_ptr<SignalSlotBase> slot = con.lock();
+if (!slot) return 0;
+SCOPE_LOCK(connectionsLock);
+int index = firstFreeConnection;
+if (index>=0) firstFreeConnection = connections[index].nextFree;
+else if (connections.size()>=(1<<CONNECTION_INDEX_BITS) -1) return 0;
+else {
+index = connections.size();
+connections.push_back({ connection(), 0, -1, false });
 }
-static int i=100;
-connections[++i] = con;
-return i;
+ConnectionEntry& e = connections[index];
+e.con = con;
+e.used = true;
+connectionsAdded++;
+return slot->registryId = (e.generation<<CONNECTION_INDEX_BITS) | (index+1);
 }
 
 connection export RemoveSignalConnection (int id) {
-connection con = connections[id];
-for (auto it=connections.begin(); it!=connections.end(); ) {
-if (!it->second.connected()) connections.erase(it++);
-else ++it;
+connection con;
+shared_ptr<SignalSlotBase> slot; // Released after the lock, as it may be the last reference to a Python callback
+{ SCOPE_LOCK(connectionsLock);
+ConnectionEntry* e = FindConnectionEntry(id);
+if (!e) return con;
+con = e->con;
+slot = con.lock();
+if (slot) slot->registryId = 0;
+FreeConnectionEntry(*e);
+connectionsRemoved++;
 }
 return con;
 }
 
+void export ReleaseSignalConnection (int id) {
+SCOPE_LOCK(connectionsLock);
+ConnectionEntry* e = FindConnectionEntry(id);
+if (!e) return;
+FreeConnectionEntry(*e);
+connectionsReleased++;
+}
+
+std::tuple<int,int,int,int,int> export GetSignalConnectionStatistics () {
+vector<connection> registered;
+int added, removed, released, stale = 0;
+{ SCOPE_LOCK(connectionsLock);
+for (auto& e: connections) if (e.used) registered.push_back(e.con);
+added = connectionsAdded;
+removed = connectionsRemoved;
+released = connectionsReleased;
+}
+for (auto& con: registered) if (!con.connected()) stale++;
+return std::make_tuple((int)registered.size(), stale, added, removed, released);
+}
+
 int Page::AddEvent (const string& type, PyGenericFunc cb) {
 connection con;
 if(false){}
@@ -1252,7 +1901,7 @@ if(false){}
 E(keyDown) E(keyUp) E(keyPress)
 E(save) E(beforeSave) E(load)
 E(attrChange) E(status) E(fileDropped) E(contextMenu) E(enter)
-E(activated) E(deactivated)
+E(activated) E(deactivated) E(fileChanged)
 #undef E
 if (con.connected()) return AddSignalConnection(con);
 else return 0;
@@ -4,13 +4,24 @@
 #include "python34.h"
 #include "IniFile.h"
 #include "signals.h"
+#include "Thread.h"
+#include "TaskScheduler.h"
 #include<functional>
+#include<tuple>
 
 #define PF_CLOSED 1
 #define PF_READONLY 2
 #define PF_MUSTSAVEAS 4
 #define PF_AUTOLINEBREAK 8
 #define PF_WRITETOSTDOUT 0x10
+#define PF_SAVING 0x20
+#define PF_TRIMTRAILINGSPACES 0x40
+#define PF_INSERTFINALNEWLINE 0x80
+#define PF_FIXBUFFERONSAVE 0x100
+#define PF_CHANGEDONDISK 0x200
+#define PF_TAIL 0x400
+#define PF_TAILFOLLOW 0x800
+#define PF_LOADING 0x1000
 
 #define PF_NOAUTOINDENT 0x8000
 #define PF_NOSMARTPASTE 0x10000
@@ -41,6 +52,8 @@
 #define PA_TAB_WIDTH 6
 
 struct export Page;
+struct File;
+struct SessionEntry;
 
 struct export UndoState {
 virtual void Undo (Page&) = 0;
@@ -74,15 +87,20 @@ static export shared_ptr<PageGroup> FindGroupContainingMenu (HMENU menu, UINT id
 
 struct export Page: std::enable_shared_from_this<Page>  {
 tstring name=TEXT(""), file=TEXT("");
-int encoding=-1, indentationMode=-1, tabWidth=-2, lineEnding=-1, markedPosition=0, curUndoState=0;
-unsigned long long flags = 0, lastSave=0;
+int encoding=-1, indentationMode=-1, tabWidth=-2, lineEnding=-1, markedPosition=0, curUndoState=0, tailTimer=0;
+unsigned int editGeneration=0; // Incremented each time the text is modified
+unsigned int textSnapshotGeneration=0;
+std::shared_ptr<const tstring> textSnapshot;
+unsigned long long flags = 0, lastSave=0, tailOffset=0;
+string tailCarry;
 HWND zone=0;
 PySafeObject pyData;
 IniFile dotEditorConfig;
 std::vector<shared_ptr<UndoState>> undoStates;
 std::unordered_map<tstring, std::shared_ptr<PageGroup>> groups;
+Task saveTask;
 
-signal<void(shared_ptr<Page>)> ondeactivated, onactivated, onclosed, onsaved;
+signal<void(shared_ptr<Page>)> ondeactivated, onactivated, onclosed, onsaved, onfileChanged;
 signal<void(shared_ptr<Page>, int,any)> onattrChange;
 signal<bool(shared_ptr<Page>), BoolSignalCombiner> onclose, ondeactivate;
 signal<bool(shared_ptr<Page>,int), BoolSignalCombiner> onkeyDown, onkeyUp, oncontextMenu;
@@ -116,11 +134,20 @@ virtual void Focus ();
 virtual void SetFont (HFONT);
 virtual bool Close () ;
 virtual int LoadFile (const tstring& fn = TEXT(""), bool guessFormat=true ) ;
-virtual bool LoadData (const string& data, bool guessFormat=true);
-virtual bool Save (bool saveAs=false);
-virtual bool SaveFile (const tstring& fn = TEXT(""));
-virtual string SaveData ();
+// Reads and decodes the file on a worker thread, then sets the text on the UI thread and calls done with what LoadFile would have returned; the page is read-only meanwhile
+// The format of the known entry is taken instead of being guessed if the file hasn't changed since
+virtual Task LoadFileInBackground (int priority, const std::function<void(Page&,int)>& done, const SessionEntry* known = NULL);
+virtual bool LoadData (const char* data, int len, bool guessFormat=true);
+inline bool LoadData (const string& data, bool guessFormat=true) { return LoadData(data.data(), data.size(), guessFormat); }
+virtual bool Save (bool saveAs=false, bool async=false);
+virtual bool SaveFile (const tstring& fn = TEXT(""), bool async=false);
+virtual bool SaveFileInBackground ();
+virtual void WaitForSave ();
+virtual bool SaveData (File& fd);
 virtual bool CheckFileModification ();
+virtual void OnFileChangedOnDisk (unsigned long long lastModified);
+virtual void SetTail (bool tail);
+virtual bool ReadAppendedData ();
 virtual void Copy () ;
 virtual void Cut ();
 virtual void Paste ();
@@ -134,9 +161,13 @@ virtual void UpdateStatusBar (HWND) ;
 virtual void GetSelection (int& start, int& end);
 virtual tstring GetSelectedText () ;
 virtual tstring GetText () ;
+// Copy of the text shared by all callers until the next edit; must be called from the UI thread
+std::shared_ptr<const tstring> GetTextSnapshot ();
 virtual tstring GetTextSubstring (int start, int end);
 virtual int GetTextLength () ;
 virtual void ReplaceTextRange (int start, int end, const tstring& str, bool keepOldSelection=true);
+// Replaces each range (start, end) by the given text as a single undo state; returns false without doing anything if ranges overlap or are out of bounds
+virtual bool ApplyEdits (std::vector<std::tuple<int,int,tstring>>& edits);
 virtual tstring GetLine (int line) ;
 virtual int GetLineCount () ;
 virtual int GetLineLength (int line);
@@ -154,6 +185,8 @@ virtual int GetCurrentPosition ();
 virtual void SetCurrentPosition  (int);
 virtual void SetCurrentPositionLC (int, int);
 virtual void GoToDialog ();
+virtual void GoToMatchingBracket ();
+virtual void SelectToMatchingBracket ();
 virtual void FindDialog () ;
 virtual void FindReplaceDialog () ;
 virtual bool Find(const tstring& searchText, bool scase, bool regex, bool up, bool stealthty);
@@ -180,5 +213,9 @@ static inline shared_ptr<Page> outCast (PyObject* o) { return Page::FromPyData(o
 
 int export AddSignalConnection (const connection& con);
 connection export RemoveSignalConnection (int id);
+// Status bar refreshes, refreshes which left it unchanged, duration of the last one and average duration in microseconds
+std::tuple<int,int,double,double> export GetStatusBarStatistics ();
+// To be called whenever the status bar is written by other means than UpdateStatusBar, so that the next refresh isn't skipped
+void export InvalidateStatusBar ();
 
 #endif
@@ -2,34 +2,223 @@
 #define _____SIGNALS_H9
 #include "any.h"
 #include<functional>
-#include<boost/signals2.hpp>
-using boost::signals2::signal;
-using boost::signals2::connection;
+#include<memory>
+#include<vector>
+#include<new>
+#include<type_traits>
+#include<climits>
+#include<tuple>
+
+/* Lightweight signals and slots
+Signals are single-threaded: they must be connected, disconnected and invoked from the UI thread.
+Invoking a signal without any slot connected only costs a comparison.
+Slots can be connected or disconnected from within a slot being called; slots connected while the signal is being invoked are only called from the next invocation on.
+*/
+
+template<class T, int N> class SmallVector {
+T* items;
+int count, capacity;
+typename std::aligned_storage<sizeof(T), alignof(T)>::type local[N];
+void grow () {
+T* p = (T*)::operator new(sizeof(T) * capacity * 2);
+for (int i=0; i<count; i++) {
+new(p+i) T(std::move(items[i]));
+items[i].~T();
+}
+if (items!=(T*)local) ::operator delete(items);
+items = p;
+capacity *= 2;
+}
+public:
+inline SmallVector (): items((T*)local), count(0), capacity(N) {}
+SmallVector (const SmallVector&) = delete;
+SmallVector& operator= (const SmallVector&) = delete;
+~SmallVector () {
+clear();
+if (items!=(T*)local) ::operator delete(items);
+}
+inline int size () const { return count; }
+inline T& operator[] (int i) { return items[i]; }
+void insert (int pos, T&& x) {
+if (count==capacity) grow();
+if (pos>=count) new(items+count) T(std::move(x));
+else {
+new(items+count) T(std::move(items[count -1]));
+for (int i=count -1; i>pos; i--) items[i] = std::move(items[i -1]);
+items[pos] = std::move(x);
+}
+count++;
+}
+inline void push_back (T&& x) { insert(count, std::move(x)); }
+template<class F> void remove_if (const F& f) {
+int j=0;
+for (int i=0; i<count; i++) {
+if (f(items[i])) continue;
+if (i!=j) items[j] = std::move(items[i]);
+j++;
+}
+while (count>j) items[--count].~T();
+}
+void clear () { while (count>0) items[--count].~T(); }
+};
+
+void export ReleaseSignalConnection (int id);
+
+struct SignalSlotBase {
+bool connected = true;
+int group = INT_MAX, registryId = 0;
+int* live = nullptr; // Number of slots connected to the signal; null once the signal is destroyed
+void disconnect () {
+if (connected && live) --*live;
+connected = false;
+}
+virtual ~SignalSlotBase () {}
+};
+
+class connection {
+std::weak_ptr<SignalSlotBase> slot;
+public:
+inline connection () {}
+inline connection (const std::shared_ptr<SignalSlotBase>& s): slot(s) {}
+inline bool connected () const { auto s = slot.lock(); return s && s->connected; }
+inline void disconnect () { auto s = slot.lock(); if (s) s->disconnect(); }
+inline std::shared_ptr<SignalSlotBase> lock () const { return slot.lock(); }
+};
+
+// Combiners receive the results of the slots one by one, and return false to stop calling the remaining slots
+template<class R> struct LastValueCombiner {
+typedef optional<R> result_type;
+optional<R> re;
+inline bool operator() (R&& r) { re = std::move(r); return true; }
+inline result_type result () { return re; }
+};
+
+template<> struct LastValueCombiner<void> {
+typedef void result_type;
+inline void result () {}
+};
 
 struct BoolSignalCombiner {
 typedef bool result_type;
-template<class I> bool operator() (I start, I end) {
 bool re = true;
-while(start!=end && (re=*start)) ++start;
-return re;
-}};
+inline bool operator() (bool b) { return re=b; }
+inline bool result () { return re; }
+};
 
 struct AnySignalCombiner {
 typedef any result_type;
-template<class I> any operator() (I start, I end) {
-int count=0;
 any re;
-while(start!=end) {
-re = *start++;
-if (!re.empty()) {
+inline bool operator() (any&& r) {
+re = std::move(r);
+if (re.empty()) return true;
 bool* b = any_cast<bool>(&re);
-if (b&&!*b) break;
+return !b || *b;
 }
+inline any result () { return re; }
+};
+
+template<class R, class C> struct SignalCaller {
+template<class F, class... A> static inline bool call (C& c, F& f, A&... args) { return c(f(args...)); }
+};
+
+template<class C> struct SignalCaller<void, C> {
+template<class F, class... A> static inline bool call (C& c, F& f, A&... args) { f(args...); return true; }
+};
+
+template<class S> struct DefaultSignalCombiner;
+template<class R, class... A> struct DefaultSignalCombiner<R(A...)> { typedef LastValueCombiner<R> type; };
+
+template<class S, class C = typename DefaultSignalCombiner<S>::type> class signal;
+
+template<class R, class... A, class C> class signal<R(A...), C> {
+public:
+typedef R signature_type (A...);
+typedef std::function<R(A...)> slot_type;
+private:
+struct Slot: SignalSlotBase {
+slot_type f;
+};
+SmallVector<std::shared_ptr<Slot>, 2> slots;
+std::vector<std::shared_ptr<Slot>> pending; // Connected while the signal is being invoked
+int live = 0, depth = 0;
+
+void insert (std::shared_ptr<Slot>&& s) {
+int pos = slots.size();
+while (pos>0 && slots[pos -1]->group>s->group) pos--;
+slots.insert(pos, std::move(s));
+}
+
+void cleanup () {
+if (live==slots.size() && pending.empty()) return;
+slots.remove_if([](const std::shared_ptr<Slot>& s){ return !s->connected; });
+for (auto& s: pending) if (s->connected) insert(std::move(s));
+pending.clear();
+}
+
+static void release (Slot& s) {
+s.live = nullptr;
+s.connected = false;
+if (s.registryId) ReleaseSignalConnection(s.registryId);
+s.registryId = 0;
+}
+
+struct Invocation {
+signal& sig;
+inline Invocation (signal& s): sig(s) { sig.depth++; }
+inline ~Invocation () { if (--sig.depth==0) sig.cleanup(); }
+};
+
+typename C::result_type invoke (A&... args) {
+C combiner;
+{ Invocation inv(*this);
+for (int i=0, n=slots.size(); i<n; i++) {
+Slot* s = slots[i].get();
+if (s->connected && !SignalCaller<R,C>::call(combiner, s->f, args...)) break;
+}}
+return combiner.result();
+}
+
+public:
+inline signal () {}
+signal (const signal&) = delete;
+signal& operator= (const signal&) = delete;
+~signal () {
+for (int i=0; i<slots.size(); i++) release(*slots[i]);
+for (auto& s: pending) release(*s);
+}
+
+// Slots are called in ascending group order, then in connection order; slots without group are called last
+connection connect (int group, const slot_type& f) {
+auto s = std::make_shared<Slot>();
+s->f = f;
+s->group = group;
+s->live = &live;
+live++;
+if (depth>0) pending.push_back(s);
+else insert(std::shared_ptr<Slot>(s));
+return connection(s);
+}
+inline connection connect (const slot_type& f) { return connect(INT_MAX, f); }
+
+void disconnect_all_slots () {
+for (int i=0; i<slots.size(); i++) slots[i]->disconnect();
+for (auto& s: pending) s->disconnect();
+if (depth==0) cleanup();
+}
+
+inline bool empty () const { return live<=0; }
+inline int num_slots () const { return live; }
+
+inline typename C::result_type operator() (A... args) {
+if (live<=0) return C().result();
+return invoke(args...);
 }
-return re;
-}};
+};
 
+// Registry of the connections made from Python, which refers to them by id
 int export AddSignalConnection (const connection& con);
 connection export RemoveSignalConnection (int id);
+// Registered, stale (no longer connected but still registered), added, removed, released when their signal was destroyed
+std::tuple<int,int,int,int,int> export GetSignalConnectionStatistics ();
 
 #endif
@@ -39,8 +39,12 @@ void EnumPythonBonusCP (vector<int>& v) {
 for (auto it: pythonEncodings) v.push_back(it.first);
 }
 
+bool export IsPythonEncoding (int encoding) {
+return pythonEncodings.find(encoding)!=pythonEncodings.end();
+}
+
 string encodeToPythonEncoding (const tstring& str, const string& prefix, const char* encoding) ;
-tstring decodeFromPythonEncoding (const string& str, int offset, const char* encoding) ;
+tstring decodeFromPythonEncoding (const char* str, int len, const char* encoding) ;
 
 string snsprintf (int max, const string& fmt, ...) {
 string out(max+1, '\0');
@@ -89,20 +93,32 @@ s[i] = buf.w;
 return s;
 }
 
+static wstring decodeMultiByte (const char* str, int len, int cp) {
+if (len<=0) return L"";
+int nSize = MultiByteToWideChar(cp, 0, str, len, NULL, 0);
+wstring ws(nSize, L'\0');
+ws.resize(MultiByteToWideChar(cp, 0, str, len, (wchar_t*)(ws.data()), nSize));
+return ws;
+}
+
 tstring ConvertFromEncoding (const string& str, int encoding) {
+return ConvertFromEncoding(str.data(), str.size(), encoding);
+}
+
+tstring ConvertFromEncoding (const char* str, int len, int encoding) {
 switch(encoding){
-case CP_UTF8: return toTString(toWString(str, encoding));
-case CP_UTF8_BOM: return toTString( toWString(str, CP_UTF8, 3, 0));
-case CP_UTF16_LE: return toTString(wstring( (const wchar_t*)(str.data()), str.size()/2));
-case CP_UTF16_LE_BOM: return toTString(wstring( (const wchar_t*)(str.data()+2), str.size()/2 -1));
-case CP_UTF16_BE: return toTString(utf16beSwitchEndianess(wstring( (const wchar_t*)(str.data()), str.size()/2)));
-case CP_UTF16_BE_BOM: return toTString(utf16beSwitchEndianess(wstring( (const wchar_t*)(str.data()+2), str.size()/2 -1)));
-case CP_UTF32_LE_BOM: return decodeFromPythonEncoding(str, 4, "utf_32_le");
-case CP_UTF32_BE_BOM: return decodeFromPythonEncoding(str, 4, "utf_32_be");
+case CP_UTF8: return toTString(decodeMultiByte(str, len, encoding));
+case CP_UTF8_BOM: return toTString(decodeMultiByte(str+3, len -3, CP_UTF8));
+case CP_UTF16_LE: return toTString(wstring( (const wchar_t*)str, len/2));
+case CP_UTF16_LE_BOM: return toTString(wstring( (const wchar_t*)(str+2), max(0, len/2 -1)));
+case CP_UTF16_BE: return toTString(utf16beSwitchEndianess(wstring( (const wchar_t*)str, len/2)));
+case CP_UTF16_BE_BOM: return toTString(utf16beSwitchEndianess(wstring( (const wchar_t*)(str+2), max(0, len/2 -1))));
+case CP_UTF32_LE_BOM: return decodeFromPythonEncoding(str+4, len -4, "utf_32_le");
+case CP_UTF32_BE_BOM: return decodeFromPythonEncoding(str+4, len -4, "utf_32_be");
 default: {
 auto it = pythonEncodings.find(encoding);
-if (it!=pythonEncodings.end()) return decodeFromPythonEncoding(str, 0, it->second.c_str() );
-else return toTString(toWString(str, encoding));
+if (it!=pythonEncodings.end()) return decodeFromPythonEncoding(str, len, it->second.c_str() );
+else return toTString(decodeMultiByte(str, len, encoding));
 }}}
 
 string ConvertToEncoding (const tstring& str, int encoding) {
@@ -135,9 +151,46 @@ if (it!=pythonEncodings.end()) return encodeToPythonEncoding(str, "", it->second
 else return toString(str, encoding);
 }}}
 
-static inline BOOL testUtf8rule (const unsigned char** x, int n) {
+void AppendEncodedText (string& out, const TCHAR* str, int len, int encoding) {
+if (len<=0) return;
+int pos = out.size();
+switch(encoding){
+case CP_UTF16_LE:
+case CP_UTF16_LE_BOM:
+out.append((const char*)str, len*2);
+break;
+case CP_UTF16_BE:
+case CP_UTF16_BE_BOM:
+out.resize(pos+len*2);
+for (int i=0; i<len; i++) {
+out[pos+2*i] = (char)(str[i]>>8);
+out[pos+2*i+1] = (char)(str[i]&0xFF);
+}
+break;
+default: {
+auto it = pythonEncodings.find(encoding);
+if (it!=pythonEncodings.end()) out += encodeToPythonEncoding(tstring(str, len), "", it->second.c_str() );
+else {
+int cp = (encoding==CP_UTF8_BOM? CP_UTF8 : encoding);
+int n = WideCharToMultiByte(cp, 0, str, len, NULL, 0, NULL, NULL);
+out.resize(pos+n);
+n = WideCharToMultiByte(cp, 0, str, len, (char*)(out.data()+pos), n, NULL, NULL);
+out.resize(pos+n);
+}}}}
+
+string GetEncodingSignature (int encoding) {
+switch(encoding){
+case CP_UTF8_BOM: return "\xEF\xBB\xBF";
+case CP_UTF16_LE_BOM: return "\xFF\xFE";
+case CP_UTF16_BE_BOM: return "\xFE\xFF";
+case CP_UTF32_LE_BOM: return string("\xFF\xFE\0\0",4);
+case CP_UTF32_BE_BOM: return string("\0\0\xFE\xFF",4);
+default: return "";
+}}
+
+static inline BOOL testUtf8rule (const unsigned char** x, int n, const unsigned char* end) {
 int i = 0;
-while (i<n && (*++(*x)&0xC0)==0x80) i++;
+while (i<n && *x+1<end && (*++(*x)&0xC0)==0x80) i++;
 return i==n;
 }
 
@@ -152,15 +205,15 @@ if (len>=2 && ch[0]==254 && ch[1]==255) return CP_UTF16_BE_BOM;
 if (len>=6 && ch[1]==0 && ch[3]==0 && ch[5]==0) return CP_UTF16_LE;
 if (len>=6 && ch[0]==0 && ch[2]==0 && ch[4]==0) return CP_UTF16_BE;
 BOOL encutf = FALSE;
-int count = 0;
-for (const unsigned char* x = ch; *x && count<len && count<DETECTION_MAX_LOOKUP; ++x, count++) {
+const unsigned char* end = ch + min(len, DETECTION_MAX_LOOKUP); // The data isn't necessarily null-terminated, e.g. when it is a mapped file
+for (const unsigned char* x = ch; x<end && *x; ++x) {
 if (*x<0x80) continue;
 if (*x==164) return CP_ISO_8859_15;
 else if (*x>=0x80 && *x<=0xA0 && *x!=146) return oemdef;
 else if ((*x>=0x80 && *x<0xC0) || *x>=248) return acpdef;
-else if (*x>=0xF0 && !testUtf8rule(&x, 3)) return acpdef;
-else if (*x>=0xE0 && !testUtf8rule(&x, 2)) return acpdef;
-else if (*x>=0xC0 && !testUtf8rule(&x, 1)) return acpdef;
+else if (*x>=0xF0 && !testUtf8rule(&x, 3, ch+len)) return acpdef;
+else if (*x>=0xE0 && !testUtf8rule(&x, 2, ch+len)) return acpdef;
+else if (*x>=0xC0 && !testUtf8rule(&x, 1, ch+len)) return acpdef;
 encutf = TRUE;
 }
 return encutf? CP_UTF8 : def;
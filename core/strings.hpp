@@ -228,7 +228,12 @@ int export guessLineEnding (const TCHAR* str, int len, int def);
 
 
 tstring export ConvertFromEncoding (const std::string& str, int encoding);
+tstring export ConvertFromEncoding (const char* str, int len, int encoding);
+// Whether converting from or to the encoding goes through Python
+bool export IsPythonEncoding (int encoding);
 std::string export ConvertToEncoding (const tstring& str, int encoding);
+void export AppendEncodedText (std::string& out, const TCHAR* str, int len, int encoding);
+std::string export GetEncodingSignature (int encoding);
 const std::vector<int>& export getAllAvailableEncodings ();
 
 template<class T> int strnatcmp (const T* L, const T* R) {
@@ -0,0 +1,131 @@
+#include "global.h"
+#include "strings.hpp"
+#include "IniFile.h"
+#include "Thread.h"
+#include "python34.h"
+#include "sixpad.h"
+#include "page.h"
+#include "accelerators.h"
+#include<algorithm>
+using namespace std;
+
+/* An extension of the plugins directory may come with a manifest, plugins\name\extension.ini, telling what it reacts to:
+events: window events which need the extension, among those in lazyEvents below; other events, e.g. pageOpened, happen at startup anyway
+fileTypes: file extensions of the pages which need the extension
+commands: shortcut keys of the commands of the extension
+Such an extension isn't imported at startup; stubs stand for it instead and import it the first time one of these happens, right before the event is emitted
+Once imported, extensions usually initialize the pages already open themselves, so activation happens before the page concerned is added
+*/
+
+extern tstring appDir;
+extern vector<shared_ptr<Page>> pages;
+void PyLoadExtension (const string& name);
+
+struct LazyExtension {
+string name;
+vector<string> events;
+vector<tstring> fileTypes;
+vector<int> commands; // Stub commands bound to the shortcut keys of the extension
+};
+
+static vector<LazyExtension> lazyExtensions; // Only accessed from the UI thread
+static const char* lazyEvents[] = { "pageBeforeOpen", "close", "fileDropped", "quickJump", "quickJumpAutocomplete", NULL };
+
+static bool IsLazyEvent (const string& event) {
+for (const char** e=lazyEvents; *e; e++) if (event==*e) return true;
+return false;
+}
+
+static vector<tstring> SplitList (const tstring& s) {
+vector<tstring> re;
+for (tstring item: split(s, TEXT(","))) {
+boost::trim(item);
+if (!item.empty()) re.push_back(item);
+}
+return re;
+}
+
+static tstring FileTypeOf (const tstring& file) {
+int slash = file.find_last_of(TEXT("\\/")), dot = file.rfind('.');
+if (dot<0 || dot<slash) return tstring();
+return to_lower_copy(file.substr(dot+1));
+}
+
+static bool MatchesFileType (const LazyExtension& e, const tstring& file) {
+tstring type = FileTypeOf(file);
+return !type.empty() && find(e.fileTypes.begin(), e.fileTypes.end(), type)!=e.fileTypes.end();
+}
+
+static bool ActivateLazyExtension (const string& name) {
+auto it = find_if(lazyExtensions.begin(), lazyExtensions.end(), [&](const LazyExtension& e){ return e.name==name; });
+if (it==lazyExtensions.end()) return false;
+for (int cmd: it->commands) {
+RemoveAccelerator(sp.hAccel, cmd);
+RemoveUserCommand(cmd);
+}
+lazyExtensions.erase(it);
+GIL_PROTECT
+PyLoadExtension(name);
+return true;
+}
+
+// The command of the extension bound to the same key, if any, is run once it has been imported
+// Activation is posted, so that the stub command isn't removed while it is running
+static void ActivateByCommand (const string& name, int flags, int key) {
+RunAsync([=]()mutable{
+if (!ActivateLazyExtension(name)) return;
+int cmd = 0;
+if (FindAccelerator(sp.hAccel, cmd, flags, key)) PostMessage(sp.win, WM_COMMAND, cmd, 0);
+});
+}
+
+bool RegisterLazyExtension (const string& name) {
+if (name.empty() || name.find_first_of(".\\/")!=string::npos) return false;
+IniFile manifest;
+if (!manifest.load(appDir + TEXT("\\plugins\\") + toTString(name) + TEXT("\\extension.ini"))) return false;
+LazyExtension e;
+e.name = name;
+for (const tstring& event: SplitList(manifest.get("events", tstring()))) {
+// Other events require the extension from the start
+if (!IsLazyEvent(toString(event))) return false;
+e.events.push_back(toString(event));
+}
+for (const tstring& type: SplitList(manifest.get("fileTypes", tstring()))) e.fileTypes.push_back(to_lower_copy(type[0]=='.'? type.substr(1) : type));
+vector<pair<int,int>> keys;
+for (const tstring& kn: SplitList(manifest.get("commands", tstring()))) {
+int flags=0, key=0;
+if (!KeyNameToCode(kn, flags, key)) return false;
+keys.push_back(make_pair(flags, key));
+}
+if (e.events.empty() && e.fileTypes.empty() && keys.empty()) return false;
+for (auto& p: pages) if (MatchesFileType(e, p->file)) return false;
+for (auto& k: keys) {
+int flags = k.first, key = k.second;
+int cmd = AddUserCommand(function<void()>([=](){ ActivateByCommand(name, flags, key); }));
+if (cmd<=0) continue;
+AddAccelerator(sp.hAccel, flags, key, cmd);
+e.commands.push_back(cmd);
+}
+lazyExtensions.push_back(e);
+return true;
+}
+
+void ActivateLazyExtensions (const char* event) {
+if (lazyExtensions.empty()) return;
+vector<string> names;
+for (const LazyExtension& e: lazyExtensions) if (find(e.events.begin(), e.events.end(), event)!=e.events.end()) names.push_back(e.name);
+for (const string& name: names) ActivateLazyExtension(name);
+}
+
+void ActivateLazyExtensionsForFile (const tstring& file) {
+if (lazyExtensions.empty() || file.empty()) return;
+vector<string> names;
+for (const LazyExtension& e: lazyExtensions) if (MatchesFileType(e, file)) names.push_back(e.name);
+for (const string& name: names) ActivateLazyExtension(name);
+}
+
+vector<string> GetLazyExtensions () {
+vector<string> re;
+for (const LazyExtension& e: lazyExtensions) re.push_back(e.name);
+return re;
+}
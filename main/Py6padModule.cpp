@@ -6,7 +6,9 @@
 #include "Resource.h"
 #include "Thread.h"
 #include "sixpad.h"
+#include "page.h"
 #include "UniversalSpeech.h"
+#include "StartupProfile.h"
 using namespace std;
 
 extern IniFile config, msgs;
@@ -24,7 +26,11 @@ bool PyRegister_Window (PyObject* m);
 bool PyRegister_Page(PyObject* m);
 bool PyRegister_MenuItem (PyObject* m);
 bool PyRegister_TaskDialog (PyObject* m);
+bool PyRegister_Future (PyObject* m);
+PyObject* PySubmit (PyObject* unused, PyObject* args);
 PyObject* CreatePyWindowObject ();
+bool RegisterLazyExtension (const string& name);
+vector<string> GetLazyExtensions ();
 
 static int PyInclude (const string& fn) {
 bool result = false;
@@ -74,12 +80,21 @@ RunSync([&]()mutable{ func(&sp); });
 return true;
 }
 
-static void PyLoadExtension (const string& name) {
+void PyLoadExtension (const string& name) {
+StartupSpan span("extension", toTString(name));
 if (ends_with(name, ".py")) PyInclude(name);
 else if (ends_with(name, ".dll")) LoadDLLExtension(name);
 else if (!PyImport_ImportModule(name.c_str())) PyErr_Print();
 }
 
+static vector<string> PyGetLazyExtensions () {
+vector<string> re;
+Py_BEGIN_ALLOW_THREADS
+RunSync([&]()mutable{ re = GetLazyExtensions(); });
+Py_END_ALLOW_THREADS
+return re;
+}
+
 static bool PyLoadLang (const tstring& langfile) {
 return msgs.load(langfile);
 }
@@ -96,6 +111,14 @@ static bool PyIsUIThread () {
 return IsUIThread();
 }
 
+static tstring PyPregReplace (const tstring& str, const tstring& needle, const tstring& repl, OPT, bool icase, bool literal) {
+tstring re;
+Py_BEGIN_ALLOW_THREADS
+re = preg_replace(str, needle, repl, icase, literal);
+Py_END_ALLOW_THREADS
+return re;
+}
+
 static PyMethodDef _6padMainDefs[] = {
 // Translation management
 PyDecl("msg", msg),
@@ -118,9 +141,16 @@ PyDecl("braille", PyBraille),
 // Extension, includes and other general functions
 PyDecl("include", PyInclude),
 PyDecl("loadExtension", PyLoadExtension),
+PyDecl("lazyExtensions", PyGetLazyExtensions),
 PyDecl("loadTranslation", PyLoadLang),
 PyDecl("isUIThread", PyIsUIThread),
-PyDecl("preg_replace", preg_replace),
+{"submit", PySubmit, METH_VARARGS, NULL},
+PyDecl("preg_replace", PyPregReplace),
+PyDecl("listArchive", ListZipArchive),
+PyDecl("eventStatistics", GetSignalConnectionStatistics),
+PyDecl("statusBarStatistics", GetStatusBarStatistics),
+PyDecl("uiQueueStatistics", GetUIQueueStatistics),
+PyDecl("startupProfile", GetStartupProfile),
 
 // Overload of print, to be able to print in python console GUI
 PyDecl("sysPrint", ConsolePrint),
@@ -141,6 +171,7 @@ PyRegister_Window(mod);
 PyRegister_MenuItem(mod);
 PyRegister_Page(mod);
 PyRegister_TaskDialog(mod);
+PyRegister_Future(mod);
 //PyRegister_MyObj(mod);
 PyModule_AddObject(mod, "window", CreatePyWindowObject() );
 PyModule_AddObject(mod, "locale", Py_BuildValue("u", appLocale.c_str()));
@@ -156,6 +187,7 @@ wstring modulePath = toWString( appDir + TEXT("\\python34.zip;") + appDir + TEXT
 Py_SetPath( modulePath.c_str() );
 Py_SetProgramName(const_cast<wchar_t*>(toWString(argv[0]).c_str()));
 PyImport_AppendInittab("sixpad", PyInit_6padMain);;
+int pythonSpan = StartupSpanBegin("python", TEXT(""));
 Py_Initialize();
 {
 int argc=0;
@@ -167,24 +199,40 @@ LocalFree(args);
 PyEval_InitThreads();
 GIL_PROTECT
 {
+StartupSpan span("init.py");
 Resource res(TEXT("init.py"),257);
 auto code = res.copy();
 bool failed = !!PyRun_SimpleString(&code[0]);
 if (failed) exit(1);
 }
+StartupSpanEnd(pythonSpan);
 RunSync([](){});//Barrier to wait for the main loop to start
 if (!sp.nacked) {
+bool lazy = config.get("lazyExtensionLoading", true);
 auto p=config.equal_range("extension"); 
 for(auto it=p.first; it!=p.second; ++it) {
 string name = it->second;
-PyLoadExtension(name);
+// Extensions with a manifest are only imported once needed
+bool registered = false;
+if (lazy) {
+Py_BEGIN_ALLOW_THREADS
+RunSync([&]()mutable{ registered = RegisterLazyExtension(name); });
+Py_END_ALLOW_THREADS
+}
+if (!registered) PyLoadExtension(name);
 }}
-string pyfn = toString(appDir + TEXT("\\") + appName + TEXT(".py") , CP_ACP);
-PyInclude(pyfn);
+{
+tstring script = appDir + TEXT("\\") + appName + TEXT(".py");
+StartupSpan span("script", script);
+PyInclude(toString(script, CP_ACP));
+}
 for (auto arg: argv) {
 if (starts_with(arg, TEXT("/extension="))) PyLoadExtension(toString(arg.substr(11)));
-else if (starts_with(arg, TEXT("/run="))) PyInclude(toString(arg.substr(5)));
-}
+else if (starts_with(arg, TEXT("/run="))) {
+StartupSpan span("script", arg.substr(5));
+PyInclude(toString(arg.substr(5)));
+}}
+StartupPartDone();
 // Ohter initialization stuff goes here
 if (sp.headless) RunSync([&]()mutable{ PostQuitMessage(0); });
 if (PyRun_SimpleString("import code") || PyRun_SimpleString("code.interact(banner='')") ) exit(1);
@@ -0,0 +1,151 @@
+#include "global.h"
+#include "python34.h"
+#include "Thread.h"
+#include "TaskScheduler.h"
+#include<vector>
+#include<algorithm>
+using namespace std;
+
+// Shared between the Python object and the task running on the worker pool, which may outlive each other
+struct FutureState {
+CRITICAL_SECTION lock;
+HANDLE doneEvent;
+bool done = false;
+PySafeObject result, excType, excValue, excTraceback;
+vector<PySafeObject> callbacks;
+FutureState () { InitializeCriticalSection(&lock); doneEvent = CreateEvent(NULL, TRUE, FALSE, NULL); }
+~FutureState () { CloseHandle(doneEvent); DeleteCriticalSection(&lock); }
+};
+
+// Callbacks are always called on the UI thread, like events
+static void CallDoneCallback (PySafeObject future, PySafeObject callback) {
+RunAsync([=]()mutable{
+GIL_PROTECT
+PySafeObject re;
+re.assign(PyObject_CallFunctionObjArgs(callback.o, future.o, NULL), true);
+if (!re.o) PyErr_Print();
+future.assign(NULL);
+callback.assign(NULL);
+});
+}
+
+struct PyFuture: PyObjectBase {
+shared_ptr<FutureState> state;
+
+bool isDone () { return state->done; }
+PySafeObject result (OPT, PyObject* timeout) {
+DWORD ms = timeout && timeout!=Py_None? max(0.0, PyFloat_AsDouble(timeout)*1000) : INFINITE;
+PySafeObject re;
+if (PyErr_Occurred()) return re;
+DWORD w;
+Py_BEGIN_ALLOW_THREADS
+w = WaitForSingleObject(state->doneEvent, ms);
+Py_END_ALLOW_THREADS
+if (w!=WAIT_OBJECT_0) PyErr_SetString(PyExc_TimeoutError, "The task isn't finished");
+else if (state->excType.o) {
+Py_XINCREF(state->excType.o); Py_XINCREF(state->excValue.o); Py_XINCREF(state->excTraceback.o);
+PyErr_Restore(state->excType.o, state->excValue.o, state->excTraceback.o);
+}
+else re = state->result;
+return re;
+}
+void addDoneCallback (PyObject* callback) {
+bool done;
+{ SCOPE_LOCK(state->lock);
+done = state->done;
+if (!done) state->callbacks.push_back(callback);
+}
+if (done) CallDoneCallback((PyObject*)this, callback);
+}
+};
+
+static void PyFutureDealloc (PyObject* o) {
+((PyFuture*)o)->state.~shared_ptr<FutureState>();
+Py_TYPE(o)->tp_free(o);
+}
+
+static PyMethodDef PyFutureMethods[] = {
+PyDecl("done", &PyFuture::isDone),
+PyDecl("result", &PyFuture::result),
+PyDecl("addDoneCallback", &PyFuture::addDoneCallback),
+PyDeclEnd
+};
+
+static PyTypeObject PyFutureType = { 
+    PyVarObject_HEAD_INIT(NULL, 0) 
+    "sixpad.Future",             /* tp_name */ 
+    sizeof(PyFuture), /* tp_basicsize */ 
+    0,                         /* tp_itemsize */ 
+    PyFutureDealloc,                         /* tp_dealloc */ 
+    0,                         /* tp_print */ 
+    0,                         /* tp_getattr */ 
+    0,                         /* tp_setattr */ 
+    0,                         /* tp_reserved */ 
+    0,                         /* tp_repr */ 
+    0,                         /* tp_as_number */ 
+    0,                         /* tp_as_sequence */ 
+    0,                         /* tp_as_mapping */ 
+    0,                         /* tp_hash  */ 
+    0,                         /* tp_call */ 
+    0,                         /* tp_str */ 
+    0,                         /* tp_getattro */ 
+    0,                         /* tp_setattro */ 
+    0,                         /* tp_as_buffer */ 
+    Py_TPFLAGS_DEFAULT,        /* tp_flags */ 
+    NULL,           /* tp_doc */
+    0,                         /* tp_traverse */ 
+    0,                         /* tp_clear */ 
+    0,                         /* tp_richcompare */ 
+    0,                         /* tp_weaklistoffset */ 
+    0,                         /* tp_iter */ 
+    0,                         /* tp_iternext */ 
+    PyFutureMethods,             /* tp_methods */ 
+}; 
+
+static void RunTask (PySafeObject& future, PySafeObject& func, PySafeObject& args) {
+FutureState& state = *((PyFuture*)future.o)->state;
+vector<PySafeObject> callbacks;
+{ GIL_PROTECT
+PyObject* re = PyObject_CallObject(func.o, args.o);
+if (re) state.result.assign(re, true);
+else {
+PyObject *type, *value, *traceback;
+PyErr_Fetch(&type, &value, &traceback);
+PyErr_NormalizeException(&type, &value, &traceback);
+state.excType.assign(type, true);
+state.excValue.assign(value, true);
+state.excTraceback.assign(traceback, true);
+}
+func.assign(NULL);
+args.assign(NULL);
+}
+{ SCOPE_LOCK(state.lock);
+state.done = true;
+callbacks.swap(state.callbacks);
+}
+SetEvent(state.doneEvent);
+for (auto& callback: callbacks) CallDoneCallback(future, callback);
+future.assign(NULL);
+}
+
+PyObject* PySubmit (PyObject* unused, PyObject* args) {
+int n = PyTuple_Size(args);
+if (n<1 || !PyCallable_Check(PyTuple_GetItem(args, 0))) {
+PyErr_SetString(PyExc_TypeError, "submit expects a callable as first argument");
+return NULL;
+}
+PyFuture* f = (PyFuture*)(PyFutureType.tp_alloc(&PyFutureType, 0));
+if (!f) return NULL;
+new(&f->state) shared_ptr<FutureState>(make_shared<FutureState>());
+PySafeObject future((PyObject*)f), func(PyTuple_GetItem(args, 0)), funcArgs;
+funcArgs.assign(PyTuple_GetSlice(args, 1, n), true);
+SubmitTask([=]()mutable{ RunTask(future, func, funcArgs); });
+return (PyObject*)f;
+}
+
+bool PyRegister_Future (PyObject* m) {
+if (PyType_Ready(&PyFutureType) < 0)          return false;
+Py_INCREF(&PyFutureType); 
+PyModule_AddObject(m, "Future", (PyObject*)&PyFutureType); 
+return true;
+}
@@ -30,6 +30,23 @@ int AppRemoveEvent (const string&, int id);
 shared_ptr<Page> OpenFile (tstring filename, int flags);
 shared_ptr<Page> PageAddEmpty (bool focus, const string& type);
 
+static int PyAddEvent (const string& type, PyGenericFunc cb) {
+// Signals are connected on the UI thread, where they are invoked
+int re = 0;
+Py_BEGIN_ALLOW_THREADS
+RunSync([&]()mutable{ re = AppAddEvent(type, cb); });
+Py_END_ALLOW_THREADS
+return re;
+}
+
+static int PyRemoveEvent (const string& type, int id) {
+int re = 0;
+Py_BEGIN_ALLOW_THREADS
+RunSync([&]()mutable{ re = AppRemoveEvent(type, id); });
+Py_END_ALLOW_THREADS
+return re;
+}
+
 PyObject* PyMenuItem_GetMenuBar (void);
 int PyShowPopupMenu (const vector<tstring>&);
 
@@ -74,10 +91,12 @@ return cmd;
 
 static PyObject* PyOpenFile (const tstring& filename) {
 shared_ptr<Page> p;
+Py_BEGIN_ALLOW_THREADS
 RunSync([&]()mutable{
 if (filename.size()>0) p = OpenFile(filename, OF_CHECK_OTHER_WINDOWS);
 else p = PageAddEmpty(true, "text");
 });
+Py_END_ALLOW_THREADS
 if (!p) { Py_RETURN_NONE; }
 return p->GetPyData();
 }
@@ -215,6 +234,7 @@ return GetWindowText(status);
 
 static void PySetStatusText (const tstring& text) {
 SetWindowText(status, text);
+InvalidateStatusBar();
 }
 
 static tstring PyGetWinTitle () {
@@ -225,12 +245,27 @@ static void PySetWinTitle (const tstring& title) {
 SetWindowText(win, title);
 }
 
+// Timers are managed by the UI thread, which may need the GIL meanwhile
+static int PySetTimer (PyFunc<void()> cb, int time, bool repeat) {
+int id;
+Py_BEGIN_ALLOW_THREADS
+id = SetTimeout(cb, time, repeat);
+Py_END_ALLOW_THREADS
+return id;
+}
+
 static int PySetTimer1 (PyFunc<void()> cb, int time) {
-return SetTimeout(cb, time, false);
+return PySetTimer(cb, time, false);
 }
 
 static int PySetTimer2 (PyFunc<void()> cb, int time) {
-return SetTimeout(cb, time, true);
+return PySetTimer(cb, time, true);
+}
+
+static void PyClearTimer (int id) {
+Py_BEGIN_ALLOW_THREADS
+ClearTimeout(id);
+Py_END_ALLOW_THREADS
 }
 
 static void PyPlaySound (const tstring& filename) {
@@ -307,12 +342,13 @@ PyDecl("findAcceleratorByKey", PyFindAcceleratorByKey),
 PyDecl("showPopupMenu", &PyShowPopupMenu),
 
 // Global events management
-PyDecl("addEvent", AppAddEvent),
-PyDecl("removeEvent", AppRemoveEvent),
+PyDecl("addEvent", PyAddEvent),
+PyDecl("removeEvent", PyRemoveEvent),
 PyDecl("setTimeout", PySetTimer1),
 PyDecl("setInterval", PySetTimer2),
-PyDecl("clearTimeout", ClearTimeout),
-PyDecl("clearInterval", ClearTimeout),
+PyDecl("clearTimeout", PyClearTimer),
+PyDecl("clearInterval", PyClearTimer),
+PyDecl("timerStatistics", GetTimerStatistics),
 
 PyDeclKW("test", test123, test123kw),
 PyDeclEnd
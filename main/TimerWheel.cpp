@@ -0,0 +1,173 @@
+#include "global.h"
+#include "accelerators.h"
+#include "Thread.h"
+#include<vector>
+using namespace std;
+
+/* Timers set with SetTimeout are kept in a hierarchical timing wheel driven by a single Win32 timer, running only while timers are pending
+Each level has 64 slots; a timer is put in the first level whose slots are large enough to reach its expiration, and moved down one level at a time as the wheel turns
+Slots are doubly linked lists of entries, so that adding and removing a timer take constant time; all timers expiring at the same tick are run by the same WM_TIMER message
+*/
+#define TIMER_WHEEL_ID 1
+#define TIMER_TICK 10 // Milliseconds
+#define WHEEL_BITS 6
+#define WHEEL_SIZE (1<<WHEEL_BITS)
+#define WHEEL_LEVELS 4
+#define TIMER_INDEX_BITS 20
+
+extern HWND win;
+
+struct WheelTimer {
+UserFunction<void(void)> func;
+unsigned long long expiry; // In ticks
+int interval; // In milliseconds, 0 for timeouts
+int generation, prev, next, slot; // slot is -1 while the timer is running or free
+bool used;
+};
+
+static vector<WheelTimer> wheelTimers;
+static int slotHeads[WHEEL_LEVELS*WHEEL_SIZE];
+static int firstFreeTimer = -1, pendingTimers = 0, timersFired = 0, timerDispatches = 0, largestDispatch = 0;
+static unsigned long long wheelStart = 0, currentTick = 0;
+static bool wheelRunning = false;
+static struct WheelInit { WheelInit () { fill(slotHeads, slotHeads + WHEEL_LEVELS*WHEEL_SIZE, -1); } } wheelInit;
+
+static inline unsigned long long NowTick () {
+return (GetTickCount64() - wheelStart) / TIMER_TICK;
+}
+
+static void LinkTimer (int index) {
+WheelTimer& t = wheelTimers[index];
+unsigned long long delta = t.expiry>currentTick? t.expiry - currentTick : 0;
+int level = 0;
+while (level<WHEEL_LEVELS -1 && delta>=(1ULL<<(WHEEL_BITS*(level+1)))) level++;
+// Timers further than the last level can reach wait in its last slot, and are put back in the wheel when it is reached
+unsigned long long at = min(currentTick+delta, currentTick + (1ULL<<(WHEEL_BITS*WHEEL_LEVELS)) -1);
+t.slot = level*WHEEL_SIZE + ((at>>(WHEEL_BITS*level)) & (WHEEL_SIZE -1));
+t.prev = -1;
+t.next = slotHeads[t.slot];
+if (t.next>=0) wheelTimers[t.next].prev = index;
+slotHeads[t.slot] = index;
+}
+
+static void UnlinkTimer (int index) {
+WheelTimer& t = wheelTimers[index];
+if (t.slot<0) return;
+if (t.prev>=0) wheelTimers[t.prev].next = t.next;
+else slotHeads[t.slot] = t.next;
+if (t.next>=0) wheelTimers[t.next].prev = t.prev;
+t.slot = t.prev = t.next = -1;
+}
+
+static void FreeTimer (int index) {
+WheelTimer& t = wheelTimers[index];
+UnlinkTimer(index);
+t.func = UserFunction<void(void)>();
+t.used = false;
+t.generation++;
+t.next = firstFreeTimer;
+firstFreeTimer = index;
+pendingTimers--;
+}
+
+static int FindTimer (int id) {
+int index = (id & ((1<<TIMER_INDEX_BITS) -1)) -1, generation = id>>TIMER_INDEX_BITS;
+if (index<0 || index>=wheelTimers.size()) return -1;
+WheelTimer& t = wheelTimers[index];
+return t.used && (t.generation & 0x7FF)==generation? index : -1;
+}
+
+// Moves the timers of a slot of an upper level to the lower levels
+static void Cascade (int level) {
+int slot = level*WHEEL_SIZE + ((currentTick>>(WHEEL_BITS*level)) & (WHEEL_SIZE -1));
+int index = slotHeads[slot];
+slotHeads[slot] = -1;
+while (index>=0) {
+int next = wheelTimers[index].next;
+LinkTimer(index);
+index = next;
+}}
+
+static void RunTimers () {
+vector<pair<int,int>> expired;
+for (unsigned long long now = NowTick(); currentTick<now; ) {
+currentTick++;
+for (int level=1; level<WHEEL_LEVELS && !(currentTick & ((1ULL<<(WHEEL_BITS*level)) -1)); level++) Cascade(level);
+int slot = currentTick & (WHEEL_SIZE -1), index = slotHeads[slot];
+slotHeads[slot] = -1;
+while (index>=0) {
+WheelTimer& t = wheelTimers[index];
+expired.push_back(make_pair(index, t.generation));
+index = t.next;
+t.slot = t.prev = t.next = -1;
+}}
+timerDispatches++;
+largestDispatch = max<int>(largestDispatch, expired.size());
+for (auto& e: expired) {
+// An earlier callback of the same dispatch may have cleared this timer
+int index = e.first;
+if (!wheelTimers[index].used || wheelTimers[index].generation!=e.second) continue;
+UserFunction<void(void)> f = wheelTimers[index].func;
+timersFired++;
+f();
+WheelTimer& t = wheelTimers[index];
+if (!t.used || t.generation!=e.second || t.slot>=0) continue;
+if (!t.interval) FreeTimer(index);
+else {
+t.expiry = currentTick + max(1, t.interval/TIMER_TICK);
+LinkTimer(index);
+}}
+if (!pendingTimers && wheelRunning) {
+KillTimer(win, TIMER_WHEEL_ID);
+wheelRunning = false;
+}}
+
+int SetTimeout (const UserFunction<void(void)>& f, int time, bool repeat) {
+if (!IsUIThread()) {
+int id = 0;
+RunSync([&]()mutable{ id = SetTimeout(f, time, repeat); });
+return id;
+}
+if (!wheelRunning) {
+// The wheel is empty, it can start again from the current time
+if (!wheelStart) wheelStart = GetTickCount64();
+currentTick = NowTick();
+SetTimer(win, TIMER_WHEEL_ID, TIMER_TICK, NULL);
+wheelRunning = true;
+}
+int index = firstFreeTimer;
+if (index>=0) firstFreeTimer = wheelTimers[index].next;
+else {
+if (wheelTimers.size()>=(1<<TIMER_INDEX_BITS) -1) return 0;
+index = wheelTimers.size();
+wheelTimers.push_back({ UserFunction<void(void)>(), 0, 0, 0, -1, -1, -1, false });
+}
+WheelTimer& t = wheelTimers[index];
+t.func = f;
+t.used = true;
+t.interval = repeat? max(time, 1) : 0;
+// Ticks already elapsed but not yet processed are counted in the delay
+t.expiry = NowTick() + max(1, (time + TIMER_TICK -1) / TIMER_TICK);
+LinkTimer(index);
+pendingTimers++;
+return ((t.generation & 0x7FF) << TIMER_INDEX_BITS) | (index+1);
+}
+
+void ClearTimeout (int id) {
+if (!IsUIThread()) {
+RunSync([&]()mutable{ ClearTimeout(id); });
+return;
+}
+int index = FindTimer(id);
+if (index>=0) FreeTimer(index);
+}
+
+bool HandleTimerMessage (WPARAM id) {
+if (id!=TIMER_WHEEL_ID) return false;
+RunTimers();
+return true;
+}
+
+std::tuple<int,int,int,int> GetTimerStatistics () {
+return std::make_tuple(pendingTimers, timersFired, timerDispatches, largestDispatch);
+}
@@ -4,7 +4,7 @@
 using namespace std;
 
 extern HWND win;
-extern unordered_map<int, UserFunction<void(void)>> userCommands, timers;
+extern unordered_map<int, UserFunction<void(void)>> userCommands;
 
 extern tstring msg (const char* name);
 
@@ -172,17 +172,4 @@ return true;
 return false;
 }
 
-int SetTimeout (const UserFunction<void(void)>& f, int time, bool repeat) {
-int id = 0;
-if (!repeat) id |= 0x8000;
-while(timers[++id]);
-timers[id] = f;
-SetTimer(win, id, time, NULL);
-}
-
-void ClearTimeout (int id) {
-KillTimer(win, id);
-auto it = timers.find(id);
-if (it!=timers.end()) timers.erase(it);
-}
 
@@ -3,6 +3,7 @@
 #include "global.h"
 #include "python34.h"
 #include<functional>
+#include<tuple>
 
 template<class S> struct UserFunction {
 std::function<S> func;
@@ -27,5 +28,8 @@ tstring KeyCodeToName (int flags, int vk, bool i18n);
 bool KeyNameToCode (const tstring& kn, int& flags, int& key);
 int SetTimeout (const UserFunction<void(void)>& f, int time, bool repeat);
 void ClearTimeout (int id);
+bool HandleTimerMessage (WPARAM id);
+// Number of pending timers, of timers run, of WM_TIMER messages handled and largest number of timers run by one of them
+std::tuple<int,int,int,int> GetTimerStatistics ();
 
 #endif
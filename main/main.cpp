@@ -6,11 +6,13 @@
 #include "dialogs.h"
 #include "accelerators.h"
 #include "Thread.h"
+#include "RecoveryJournal.h"
+#include "SessionSnapshot.h"
+#include "StartupProfile.h"
 #include "Resource.h"
 #include "UniversalSpeech.h"
 #include "python34.h"
 #include "sixpad.h"
-#include<boost/signals2.hpp>
 #include<list>
 #include<unordered_map>
 #include<map>
@@ -20,7 +22,6 @@
 #include<fcntl.h>
 #include<shellapi.h>
 using namespace std;
-using boost::signals2::signal;
 
 IniFile msgs, config;
 tstring appPath, appDir, appName, configFileName, appLocale;
@@ -31,7 +32,7 @@ vector<int> encodings = { GetACP(), GetOEMCP(), CP_UTF8, CP_UTF8_BOM, CP_UTF16_L
 vector<tstring> argv;
 vector<shared_ptr<Page>> pages;
 vector<HWND> modlessWindows;
-unordered_map<int, UserFunction<void(void)>> userCommands, timers;
+unordered_map<int, UserFunction<void(void)>> userCommands;
 unordered_map<string,function<Page*()>> pageFactories = { {"text", [](){return new Page();}} };
 
 signal<void()> onactivated, ondeactivated, onclosed, onresized;
@@ -59,6 +60,8 @@ void ParseLineCol (tstring& file, int& line, int& col);
 void PageReplaceIndent (shared_ptr<Page> page, int oldIndent, int newIndent);
 tstring GetErrorText (int errorCode);
 vector<tstring> GetHDROPFiles (HDROP);
+void ActivateLazyExtensions (const char* event);
+void ActivateLazyExtensionsForFile (const tstring& file);
 void CSignal ( void(*)(int) );
 LRESULT WINAPI AppWinProc (HWND, UINT, WPARAM, LPARAM);
 
@@ -91,6 +94,7 @@ r.left = 5; r.top = 5; r.right -= 10; r.bottom -= 49;
 SendMessage(tabctl, TCM_ADJUSTRECT, FALSE, &r);
 p->ShowZone(r);
 p->FocusZone();
+InvalidateStatusBar();
 p->UpdateStatusBar(status);
 UpdateWindowTitle();
 int encidx = -1; for (int i=0; i<encodings.size(); i++) { if (p->encoding==encodings[i]) { encidx=i; break; }}
@@ -109,6 +113,8 @@ EnableMenuItem2(menu, IDM_CUT, MF_BYCOMMAND, !(p->flags&PF_NOCOPY));
 EnableMenuItem2(menu, IDM_PASTE, MF_BYCOMMAND, !(p->flags&PF_NOPASTE));
 EnableMenuItem2(menu, IDM_SELECTALL, MF_BYCOMMAND, !(p->flags&PF_NOSELECTALL));
 EnableMenuItem2(menu, IDM_GOTOLINE, MF_BYCOMMAND, !(p->flags&PF_NOGOTO));
+EnableMenuItem2(menu, IDM_GOTOMATCH, MF_BYCOMMAND, !(p->flags&PF_NOGOTO));
+EnableMenuItem2(menu, IDM_SELTOMATCH, MF_BYCOMMAND, !(p->flags&PF_NOGOTO));
 EnableMenuItem2(menu, IDM_FIND, MF_BYCOMMAND, !(p->flags&PF_NOFIND));
 EnableMenuItem2(menu, IDM_FINDNEXT, MF_BYCOMMAND, !(p->flags&PF_NOFIND));
 EnableMenuItem2(menu, IDM_FINDPREV, MF_BYCOMMAND, !(p->flags&PF_NOFIND));
@@ -158,6 +164,8 @@ EnableMenuItem2(menu, IDM_CUT, MF_BYCOMMAND, false);
 EnableMenuItem2(menu, IDM_PASTE, MF_BYCOMMAND, false);
 EnableMenuItem2(menu, IDM_SELECTALL, MF_BYCOMMAND, false);
 EnableMenuItem2(menu, IDM_GOTOLINE, MF_BYCOMMAND, false);
+EnableMenuItem2(menu, IDM_GOTOMATCH, MF_BYCOMMAND, false);
+EnableMenuItem2(menu, IDM_SELTOMATCH, MF_BYCOMMAND, false);
 EnableMenuItem2(menu, IDM_FIND, MF_BYCOMMAND, false);
 EnableMenuItem2(menu, IDM_FINDNEXT, MF_BYCOMMAND, false);
 EnableMenuItem2(menu, IDM_FINDPREV, MF_BYCOMMAND, false);
@@ -172,6 +180,7 @@ EnableMenuItem2(menuFormat, 2, MF_BYPOSITION, false);
 EnableMenuItem2(menuFormat, IDM_AUTOLINEBREAK, MF_BYCOMMAND, false);
 SetWindowText(win, GetDefaultWindowTitle() );
 SetWindowText(status, NULL);
+InvalidateStatusBar();
 }
 
 inline void PageSetLineEnding (shared_ptr<Page> p, int le) {
@@ -262,9 +271,10 @@ p->onclosed.connect( 2147483647, PageClosed);
 p->onattrChange.connect(PageAttrChanged);
 }
 
-bool PageAdd (shared_ptr<Page> p, bool focus = true) {
+bool PageAdd (shared_ptr<Page> p, bool focus = true, bool load = true) {
+ActivateLazyExtensionsForFile(p->file);
 p->CreateZone(tabctl);
-int re = p->LoadFile();
+int re = load? p->LoadFile() : 0;
 if (re<0 && re!=-2) {
 MessageBox(win, GetErrorText(-re).c_str(), msg("Error").c_str(), MB_OK | MB_ICONERROR);
 return false;
@@ -300,6 +310,24 @@ PageAdd(p, focus);
 return p;
 }
 
+static void PagesRecover (const vector<RecoveredPage>& recovered) {
+for (auto& r: recovered) {
+shared_ptr<Page> p;
+if (r.file.size()>0) for (auto& x: pages) if (iequals(x->file, r.file)) { p=x; break; }
+if (!p) {
+p = PageAddEmpty(false);
+p->file = r.file;
+if (r.name.size()>0) p->SetName(r.name);
+}
+p->SetEncoding(r.encoding);
+p->SetLineEnding(r.lineEnding);
+p->SetIndentationMode(r.indentationMode);
+p->SetTabWidth(r.tabWidth);
+// A single undo step brings back the text of the file
+p->ReplaceTextRange(0, p->GetTextLength(), r.text, true);
+p->SetModified(true);
+}}
+
 void PageReopen (shared_ptr<Page> p) {
 if (!p) return;
 p->LoadFile(TEXT(""), false);
@@ -318,7 +346,9 @@ pageFactories[name] = f;
 }
 
 bool AppWindowClosing () {
+ActivateLazyExtensions("close");
 if (!onclose()) return false;
+FlushSessionSnapshot();
 for (int i=0, j=0; i<pages.size(); i++) {
 shared_ptr<Page> p = pages[i];
 if ((p->flags&PF_NOSAVE) || p->file.size()<=0) continue;
@@ -342,7 +372,10 @@ struct _tmp_{bool&b; _tmp_(bool&x):b(x){b=true;} ~_tmp_(){b=false;} } _tmp1_(on)
 onactivated();
 for (auto p: pages) {
 if (p->CheckFileModification()) {
-if (p->IsModified() && 0!=MessageBox2(win, p->name, msg("Concurrent modification in another application"), tsnprintf(512, msg("%s has been modified in another application. Do you want to reload it ?"), p->name.c_str()), {msg("&Reload"), msg("Do&n't reload")}, MB2_ICONEXCLAMATION ) ) p->lastSave = GetCurTime();
+if (p->IsModified() && 0!=MessageBox2(win, p->name, msg("Concurrent modification in another application"), tsnprintf(512, msg("%s has been modified in another application. Do you want to reload it ?"), p->name.c_str()), {msg("&Reload"), msg("Do&n't reload")}, MB2_ICONEXCLAMATION ) ) {
+p->lastSave = GetCurTime();
+p->flags &=~PF_CHANGEDONDISK;
+}
 else p->LoadFile(TEXT(""),false);
 }}}
 
@@ -419,6 +452,7 @@ else if (curPage) curPage->Paste();
 static void DoDropFiles (HDROP hDrop) {
 POINT pt;
 DragQueryPoint(hDrop, &pt);
+ActivateLazyExtensions("fileDropped");
 for (const tstring& file: GetHDROPFiles(hDrop)) {
 if (curPage && !curPage->onfileDropped(curPage, file, pt.x, pt.y)) continue;
 else if (!onfileDropped(file, pt.x, pt.y)) continue;
@@ -517,6 +551,8 @@ ParseLineCol(file, line, col);
 File::normalizePath(file);
 if ((flags&OF_CHECK_OTHER_WINDOWS) && OpenFile_CheckOtherWindows(file, line, col)) return NULL;
 string type = "text";
+ActivateLazyExtensions("pageBeforeOpen");
+ActivateLazyExtensionsForFile(file);
 optional<tstring> vtype = onpageBeforeOpen(file);
 if (vtype) type = toString(*vtype);
 shared_ptr<Page> cp = curPage;
@@ -530,6 +566,54 @@ AddToRecentFiles(file);
 return p;
 }
 
+// Tabs are created at once, then filled as their files are read on worker threads, the active one first
+// Files found in the session snapshot get back their selection and scrolling, and their format if they haven't changed
+static void RestoreSession (const vector<pair<tstring,int>>& files, const vector<SessionEntry>& entries) {
+vector<tuple<shared_ptr<Page>,int,int>> restored;
+for (auto& f: files) {
+// Scripts run in headless mode expect the files to be there
+if (headless) {
+StartupSpan span("reopen last file", f.first);
+shared_ptr<Page> p = OpenFile(f.first);
+if (p) p->SetCurrentPosition(f.second);
+continue;
+}
+// The span lasts until the file is loaded in the background
+int span = StartupSpanBegin("reopen last file", f.first);
+shared_ptr<Page> p = PageCreate("text");
+if (p) {
+p->file = f.first;
+File::normalizePath(p->file);
+p->name = p->file.substr(p->file.find_last_of(TEXT("\\/")) +1);
+}
+if (!p || !PageAdd(p, true, false)) {
+StartupSpanEnd(span);
+continue;
+}
+AddToRecentFiles(p->file);
+restored.push_back(make_tuple(p, f.second, span));
+}
+for (int active=1; active>=0; active--) for (auto& r: restored) {
+shared_ptr<Page> page = get<0>(r);
+if ((page==curPage)!=!!active) continue;
+int pos = get<1>(r), span = get<2>(r);
+auto it = find_if(entries.begin(), entries.end(), [&](const SessionEntry& e){ return e.file==page->file; });
+const SessionEntry* known = it!=entries.end()? &*it : NULL;
+SessionEntry entry = known? *known : SessionEntry();
+bool hasEntry = !!known;
+page->LoadFileInBackground(active? TASK_HIGH : TASK_NORMAL, [=](Page& p, int re){
+StartupSpanEnd(span);
+if (re<0 && re!=-2) {
+MessageBox(win, GetErrorText(-re).c_str(), msg("Error").c_str(), MB_OK | MB_ICONERROR);
+p.Close();
+return;
+}
+if (re>0 && hasEntry) RestoreSessionEntry(p, entry);
+else if (re>0) p.SetCurrentPosition(pos);
+if (curPage.get()==&p) p.UpdateStatusBar(status);
+}, known);
+}}
+
 void OpenFileDialog (int flags) {
 tstring file = (curPage? curPage->file : tstring(TEXT("")) );
 file = FileDialog(win, FD_OPEN | FD_MULTI, file, msg("Open") );
@@ -601,6 +685,7 @@ std::terminate();
 
 extern "C" int WINAPI WinMain (HINSTANCE hThisInstance,                      HINSTANCE hPrevInstance,                      LPSTR lpszArgument,                      int nWindowStile) {
 long long time = GetTickCount();
+StartupProfileBegin();
 sp.hinstance = hinstance = hThisInstance;
 if (!(isDebug = IsDebuggerPresent())) {
 set_terminate(termHandler);
@@ -626,6 +711,7 @@ if (i>=0&&i<appLocale.size()) appLocale = appLocale.substr(0,i);
 to_lower(appLocale);
 appName = fnBs+1;
 appDir = fn;
+StartupSpan span("translations");
 if (!msgs.load(appDir + TEXT("\\") + appName + TEXT("-") + appLocale + TEXT(".lng") )) msgs.load(appDir + TEXT("\\") + appName + TEXT("-english.lng") );
 }
 
@@ -644,6 +730,8 @@ arg[0]='/';
 if (arg==TEXT("/headless")) sp.headless=headless=true;
 else if (arg==TEXT("/nacked")) sp.nacked=true;
 else if (starts_with(arg, TEXT("/configfile="))) configFileName = arg.substr(12);
+else if (arg==TEXT("/profile-startup")) SetStartupTraceFile(appDir + TEXT("\\") + appName + TEXT("-startup.json"));
+else if (starts_with(arg, TEXT("/profile-startup="))) SetStartupTraceFile(arg.substr(17));
 continue; 
 } 
 if (OpenFile_StartupCheck(arg)) return 0;
@@ -659,6 +747,7 @@ dataFromStdin = f.readFully();
 firstInstance = !FindWindow(CLASSNAME,NULL);
 
 {//Load config
+StartupSpan span("config");
 if (configFileName.empty()) configFileName = appDir + TEXT("\\") + appName + TEXT(".ini");
 if (configFileName!=TEXT("-")) config.load(configFileName);
 }
@@ -683,6 +772,7 @@ if (!InitCommonControlsEx(&ccex)) return 1;
 }
 
 {//Create window block
+StartupSpan span("window");
 sp.win = win = CreateWindowEx(
 WS_EX_CONTROLPARENT | WS_EX_ACCEPTFILES,
 CLASSNAME, GetDefaultWindowTitle().c_str(), 
@@ -700,6 +790,7 @@ sp.status = status = CreateWindowEx(
 WS_VISIBLE | WS_CHILD | WS_BORDER | SS_NOPREFIX | SS_LEFT, 
 5, r.bottom -32, r.right -10, 27, 
 win, (HMENU)IDC_STATUSBAR, hinstance, NULL);
+StartupSpan menuSpan("menus");
 hAccel = LoadAccelerators(hinstance, TEXT("accel"));
 hGlobAccel = LoadAccelerators(hinstance, TEXT("globaccel"));
 menu = GetMenu(win);
@@ -718,6 +809,7 @@ SetMenuNamesFromResource(menu);
 }
 
 {//TExt font
+StartupSpan span("font");
 LOGFONT lf = { -13, 0, 0, 0, 400, 0, 0, 0, 0, 3, 2, 1, 0x31, TEXT("Lucida Console") };
 File fdFont(appDir + TEXT("\\") + appName + TEXT(".fnt"));
 if (fdFont)  fdFont.read(&lf, sizeof(lf));
@@ -739,27 +831,35 @@ for (int i=1; i<argv.size(); i++) {
 const tstring& arg = argv[i];
 if (arg.size()<=0) continue;
 else if (arg[0]=='-' || arg[0]=='/') { continue; } // options
+StartupSpan span("open file", arg);
 OpenFile(arg);
 }
 
 if (firstInstance) {//Reload last opened files
 int mode = config.get("reloadLastFilesMode",0);
 if (mode==1 && pages.size()>0) mode=0;
+vector<SessionEntry> sessionEntries;
+if (!headless && configFileName!=TEXT("-")) sessionEntries = OpenSessionSnapshot(appDir + TEXT("\\") + appName + TEXT(".6ps"), [](){ return pages; });
+vector<pair<tstring,int>> lastFiles;
 for (int i=0; config.contains("lastFile" + toString(i)); i++) {
 tstring fileName = config.get<tstring>("lastFile" + toString(i), TEXT(""));
 int pos = config.get("lastFilePos" + toString(i), 0);
 config.erase("lastFile" + toString(i));
 config.erase("lastFilePos" + toString(i));
-if (mode<=0) continue;
-shared_ptr<Page> p = OpenFile(fileName);
-p->SetCurrentPosition(pos);
-}}
+if (mode>0) lastFiles.push_back(make_pair(fileName, pos));
+}
+RestoreSession(lastFiles, sessionEntries);
+}
 if (writeToStdout || readFromStdin) {
 shared_ptr<Page> p = PageAddEmpty(false);
 if (writeToStdout) p->flags |= PF_WRITETOSTDOUT | PF_NOSAVE | PF_NORELOAD;
 p->LoadData(dataFromStdin);
 p->SetName(msg("Standard input/output"));
 }
+if (!headless) {
+vector<RecoveredPage> recovered = FindRecoveryJournals();
+if (recovered.size()>0 && IDYES==MessageBox(win, tsnprintf(512, msg("6pad++ wasn't closed normally. %d unsaved documents can be recovered. Do you want to recover them?"), recovered.size()).c_str(), msg("Recovery").c_str(), MB_YESNO | MB_ICONQUESTION)) PagesRecover(recovered);
+}
 if (pages.size()<=0) PageAddEmpty(false);
 
 time = GetTickCount() -time;
@@ -770,6 +870,11 @@ ShowWindow(win, nWindowStile);
 DragAcceptFiles(win, true);
 }
 PageActivated(pages[0]);
+if (!headless) {
+StartupSpan span("first paint");
+RedrawWindow(win, NULL, NULL, RDW_UPDATENOW | RDW_ALLCHILDREN);
+}
+StartupPartDone();
 
 MSG msg;
 while (GetMessage(&msg,NULL,0,0)) {
@@ -784,6 +889,8 @@ TranslateMessage(&msg);
 DispatchMessage(&msg);
 endmsgloop: ;
 }
+CloseRecoveryJournals();
+CloseSessionSnapshot();
 
 {int i=0; for(const tstring& file: recentFiles) {
 config.set("recentFile" + toString(i++), file);
@@ -850,6 +957,7 @@ switch(LOWORD(wp)){
 case VK_TAB: {
 int ss, se; tstring text = GetWindowText(hwnd);
 SendMessage(hwnd, EM_GETSEL, &ss, &se);
+ActivateLazyExtensions("quickJumpAutocomplete");
 optional<tstring> re = onquickJumpAutocomplete(text, min(ss,se));
 if (re) {
 tstring newText = *re;
@@ -874,6 +982,7 @@ return DefSubclassProc(hwnd, msg, wp, lp);
 }
 
 static bool ShowQuickJump () {
+ActivateLazyExtensions("quickJump");
 if (onquickJump.empty()) { MessageBeep(MB_OK); return false; }
 static HWND hLbl=0, hEdit = 0;
 if (!hLbl) hLbl = CreateWindowEx(0, TEXT("STATIC"), (msg("Quick jump") + TEXT(":")).c_str(),
@@ -906,8 +1015,8 @@ if (1==config.get("instanceMode",0)) OpenFileDialog(OF_CHECK_OTHER_WINDOWS);
 else OpenFileDialog(OF_NEW_INSTANCE); 
 return true;
 case IDM_REOPEN: PageReopen(curPage); return true;
-case IDM_SAVE: if (curPage) { curPage->Save(); AddToRecentFiles(curPage->file); } return true;
-case IDM_SAVE_AS: if (curPage) { curPage->Save(true);  AddToRecentFiles(curPage->file); } return true;
+case IDM_SAVE: if (curPage) { curPage->Save(false, true); AddToRecentFiles(curPage->file); } return true;
+case IDM_SAVE_AS: if (curPage) { curPage->Save(true, true);  AddToRecentFiles(curPage->file); } return true;
 case IDM_NEW: PageAddEmpty(true); return true;
 case IDM_CLOSE: if (curPage) curPage->Close(); return true;
 case IDM_SELECTALL: if (curPage) curPage->SelectAll(); return true;
@@ -920,6 +1029,8 @@ case IDM_MARKSEL: if (curPage) curPage->MarkCurrentPosition(); break;
 case IDM_SELTOMARK: if (curPage) curPage->SelectToMark(); break;
 case IDM_GOTOMARK: if (curPage) curPage->GoToMark(); break;
 case IDM_GOTOLINE: if (curPage) curPage->GoToDialog(); return true;
+case IDM_GOTOMATCH: if (curPage) curPage->GoToMatchingBracket(); return true;
+case IDM_SELTOMATCH: if (curPage) curPage->SelectToMatchingBracket(); return true;
 case IDM_FIND: if (curPage) curPage->FindDialog(); return true;
 case IDM_REPLACE: if (curPage) curPage->FindReplaceDialog(); return true;
 case IDM_FINDNEXT: if (curPage) curPage->FindNext(); return true;
@@ -1093,13 +1204,12 @@ Proc* proc = (Proc*)lp;
 if (wp) delete proc;
 return true;
 }break;
-case WM_TIMER: {
-int id = LOWORD(wp);
-auto it = timers.find(id);
-if (it!=timers.end()) {
-it->second();
-if (id&0x8000) ClearTimeout(id);
-}}break;
+case WM_RUNQUEUE:
+RunUIQueue();
+return true;
+case WM_TIMER:
+if (HandleTimerMessage(wp)) return true;
+break;
 case WM_COPYDATA: {
 COPYDATASTRUCT& cp = *(COPYDATASTRUCT*)(lp);
 if (cp.dwData==76) return OpenFile_CheckOpenTabsCPD((char*)cp.lpData);
@@ -1,4 +1,5 @@
 #include "PyListBoxDialog.h"
+#include "../../core/File.h"
 using namespace std;
 
 INT_PTR ListBoxDlgProc (HWND hwnd, UINT umsg, WPARAM wp, LPARAM lp); 
@@ -255,12 +256,12 @@ if (!closed) SendMessage(hDlg, WM_COMMAND, IDCANCEL, 0);
 }
 
 PyObject* PyListBoxDialog::open (PyObject* unused, PyObject* args, PyObject* kwds) {
-const wchar_t *title=TEXT(""), *hint=TEXT(""), *okText=NULL, *cancelText=NULL;
+const wchar_t *title=TEXT(""), *hint=TEXT(""), *okText=NULL, *cancelText=NULL, *archive=NULL;
 BOOL modal = false, searchField=false, multiple=false;
 PyObject* callback=NULL;
-static const char* KWLST[] = { "title", "hint", "modal", "callback", "okButtonText", "cancelButtonText", "multiple", "searchField", NULL};
-if (!PyArg_ParseTupleAndKeywords(args, kwds, "|uupOuupp", (char**)KWLST, &title, &hint, &modal, &callback, &okText, &cancelText, &multiple, &searchField)) return NULL;
-ListBoxDialogInfo lbdi = { title, hint, okText?okText:msg("&OK"), cancelText?cancelText:msg("Ca&ncel"), modal, multiple, searchField, callback, NULL };
+static const char* KWLST[] = { "title", "hint", "modal", "callback", "okButtonText", "cancelButtonText", "multiple", "searchField", "archive", NULL};
+if (!PyArg_ParseTupleAndKeywords(args, kwds, "|uupOuuppu", (char**)KWLST, &title, &hint, &modal, &callback, &okText, &cancelText, &multiple, &searchField, &archive)) return NULL;
+ListBoxDialogInfo lbdi = { title, hint, okText?okText:msg("&OK"), cancelText?cancelText:msg("Ca&ncel"), modal, multiple, searchField, callback, NULL, archive?archive:TEXT("") };
 if (modal) {
 bool cancelled;
 Py_BEGIN_ALLOW_THREADS
@@ -310,20 +311,31 @@ SetForegroundWindow(hDlg);
 
 int PyListBoxDialog::addEvent (const string& type, PyGenericFunc cb) {
 connection con;
+int id = 0;
+// Signals are connected on the UI thread, where they are invoked
+Py_BEGIN_ALLOW_THREADS
+RunSync([&]()mutable{
 if(false){}
 #define E(n) else if (type==#n) con = signals->on##n .connect(PyFunc<typename decltype(signals->on##n)::signature_type>(cb.o));
 E(action) E(select) E(contextMenu) E(search)
 E(close) E(focus) E(blur)
 E(keyDown) E(keyUp)
 #undef E
-if (con.connected()) return AddSignalConnection(con);
-else return 0;
+if (con.connected()) id = AddSignalConnection(con);
+});
+Py_END_ALLOW_THREADS
+return id;
 }
 
 int PyListBoxDialog::removeEvent (const string& type, int id) {
+bool re = false;
+Py_BEGIN_ALLOW_THREADS
+RunSync([&]()mutable{
 connection con = RemoveSignalConnection(id);
-bool re = con.connected();
+re = con.connected();
 con.disconnect();
+});
+Py_END_ALLOW_THREADS
 return re;
 }
 
@@ -410,6 +422,7 @@ else ShowWindow(GetDlgItem(hwnd, IDCANCEL), SW_HIDE);
 if (!lbdi.searchField) ShowWindow(GetDlgItem(hwnd, 1002), SW_HIDE);
 SetWindowSubclass(hLb, (SUBCLASSPROC)ListBoxSubclassProc, 0, (DWORD_PTR)&dlg);
 SetWindowSubclass(hEdit, (SUBCLASSPROC)SearchFieldSubclassProc, 0, (DWORD_PTR)&dlg);
+if (lbdi.archive.size()>0) for (const tstring& name: ListZipArchive(lbdi.archive)) dlg.append(name);
 if (lbdi.callback) lbdi.callback((PyObject*)&dlg);
 SetFocus(lbdi.searchField? hEdit : hLb);
 if (!lbdi.modal) sp->AddModlessWindow(hwnd);
@@ -59,6 +59,7 @@ tstring title, label, okText, cancelText;
 bool modal, multiple, searchField;
 PyFunc<void(PyObject*)> callback;
 PyListBoxDialog* dlg;
+tstring archive; // Zip archive whose members fill the list
 };
 
 #endif
@@ -230,20 +230,31 @@ SetForegroundWindow(hDlg);
 
 int PyTreeViewDialog::addEvent (const string& type, PyGenericFunc cb) {
 connection con;
+int id = 0;
+// Signals are connected on the UI thread, where they are invoked
+Py_BEGIN_ALLOW_THREADS
+RunSync([&]()mutable{
 if(false){}
 #define E(n) else if (type==#n) con = signals->on##n .connect(AsPyFunc<typename decltype(signals->on##n)::signature_type>(cb.o));
 E(action) E(select) E(expand) E(contextMenu) E(check)
 E(edit) E(edited) E(close) E(focus) E(blur)
 E(keyDown) E(keyUp)
 #undef E
-if (con.connected()) return AddSignalConnection(con);
-else return 0;
+if (con.connected()) id = AddSignalConnection(con);
+});
+Py_END_ALLOW_THREADS
+return id;
 }
 
 int PyTreeViewDialog::removeEvent (const string& type, int id) {
+bool re = false;
+Py_BEGIN_ALLOW_THREADS
+RunSync([&]()mutable{
 connection con = RemoveSignalConnection(id);
-bool re = con.connected();
+re = con.connected();
 con.disconnect();
+});
+Py_END_ALLOW_THREADS
 return re;
 }
 
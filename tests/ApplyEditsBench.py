@@ -0,0 +1,47 @@
+# Applies 100000 small edits to a page, first one by one through insert, replace and delete, then at once through applyEdits, and compares the time taken
+# It needs the editor: open the Python console and run exec(open(r'tests\ApplyEditsBench.py').read()) from the directory of 6pad++
+from time import perf_counter
+from sixpad import window as win
+
+EDITS = 100000
+
+def makeText ():
+	return ''.join('line %d of the text\r\n' % i for i in range(EDITS//3))
+
+# Alternately an insertion, a replacement and a deletion, spread over the whole text
+def makeEdits (text):
+	step = len(text)//EDITS
+	edits = []
+	for i in range(EDITS):
+		pos = i*step
+		if i%3==0: edits.append((pos, pos, 'x'))
+		elif i%3==1: edits.append((pos, pos+1, 'yz'))
+		else: edits.append((pos, pos+1, ''))
+	return edits
+
+# Back to front, so that the positions of the edits still to make don't move
+def applyOneByOne (page, edits):
+	for start, end, text in reversed(edits):
+		if start==end: page.insert(start, text)
+		elif text: page.replace(start, end, text)
+		else: page.delete(start, end)
+
+def bench (apply, text, edits):
+	page = win.new()
+	page.text = text
+	start = perf_counter()
+	apply(page, edits)
+	elapsed = perf_counter() - start
+	result = page.text
+	page.modified = False
+	page.close()
+	return elapsed, result
+
+text = makeText()
+edits = makeEdits(text)
+t1, r1 = bench(applyOneByOne, text, edits)
+t2, r2 = bench(lambda page, edits: page.applyEdits(edits), text, edits)
+print('%d edits on %d characters' % (len(edits), len(text)))
+print('insert/replace/delete: %.3f s' % t1)
+print('applyEdits: %.3f s, %.1f times faster' % (t2, t1/t2))
+print('Same result' if r1==r2 else 'Results differ!')
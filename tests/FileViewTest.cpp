@@ -0,0 +1,72 @@
+/* Test of File::view: regular files are mapped in memory without copy, while empty files, pipes and the &in: standard stream give an empty view and must be read
+The mapping is made with CreateFileMapping in StdFile, so this test links against the core DLL and runs on Windows only
+Build from this directory: g++ -std=gnu++14 -O2 -fno-rtti FileViewTest.cpp -o FileViewTest.exe -I../core -L../link -lqc6pad10 -m32 -mthreads
+*/
+#include "global.h"
+#include "File.h"
+using namespace std;
+
+#define DATA_SIZE (1048576 + 123)
+
+static string MakeData () {
+string data(DATA_SIZE, 0);
+for (int i=0; i<DATA_SIZE; i++) data[i] = (char)(i*131 + i/7);
+return data;
+}
+
+static bool WriteData (const tstring& file, const string& data) {
+File fd(file, true);
+return fd && fd.writeFully(data.data(), data.size());
+}
+
+static bool TestMappedFile (const tstring& file, const string& data) {
+File fd(file);
+boost::string_ref v = fd.view();
+if (v.size()!=data.size() || memcmp(v.data(), data.data(), data.size())) { printf("Mapped file: view differs from the data written\n"); return false; }
+if (fd.view().data()!=v.data()) { printf("Mapped file: the file was mapped twice\n"); return false; }
+// Mapping doesn't move the file pointer
+if (fd.readFully()!=data) { printf("Mapped file: readFully differs after view\n"); return false; }
+fd.close();
+if (fd.view().size()>0) { printf("Mapped file: view still available after close\n"); return false; }
+return true;
+}
+
+static bool TestEmptyFile (const tstring& file) {
+if (!WriteData(file, string())) { printf("Empty file: couldn't create it\n"); return false; }
+File fd(file);
+if (fd.view().size()>0 || fd.readFully().size()>0) { printf("Empty file: not empty\n"); return false; }
+return true;
+}
+
+static bool TestStdin (const string& data) {
+HANDLE readEnd, writeEnd, oldStdin = GetStdHandle(STD_INPUT_HANDLE);
+if (!CreatePipe(&readEnd, &writeEnd, NULL, DATA_SIZE+4096)) { printf("Pipe: couldn't create it\n"); return false; }
+DWORD written = 0;
+WriteFile(writeEnd, data.data(), data.size(), &written, NULL);
+CloseHandle(writeEnd);
+SetStdHandle(STD_INPUT_HANDLE, readEnd);
+string read;
+bool mapped;
+{ File fd(TEXT("&in:"));
+mapped = fd.view().size()>0;
+read = fd.readFully();
+}
+SetStdHandle(STD_INPUT_HANDLE, oldStdin);
+CloseHandle(readEnd);
+if (mapped) { printf("Pipe: a view was given for a pipe\n"); return false; }
+if (read!=data) { printf("Pipe: read %d bytes instead of %d\n", (int)read.size(), (int)data.size()); return false; }
+return true;
+}
+
+int main () {
+tstring file = TEXT("FileViewTest.tmp");
+string data = MakeData();
+if (!WriteData(file, data)) {
+printf("Couldn't create %ls\n", file.c_str());
+return 1;
+}
+bool ok = TestMappedFile(file, data) && TestEmptyFile(file) && TestStdin(data);
+DeleteFile(file.c_str());
+printf("%s\n", ok? "ok" : "failed");
+return ok? 0 : 1;
+}
@@ -0,0 +1,61 @@
+/* Stress test of MPSCQueue with many producers and a single consumer, as used by the UI queue
+Builds and runs on its own, e.g. on Linux: g++ -std=c++14 -O2 -pthread -I../core MPSCQueueStress.cpp -o MPSCQueueStress && ./MPSCQueueStress
+Add -fsanitize=thread to check the memory ordering as well
+*/
+#include "MPSCQueue.h"
+#include<thread>
+#include<vector>
+#include<cstdio>
+#include<atomic>
+using namespace std;
+
+#define PRODUCERS 16
+#define ITEMS_PER_PRODUCER 200000
+#define ROUNDS 5
+
+struct Item {
+int producer, seq;
+};
+
+static bool RunRound (int round) {
+MPSCQueue<Item> q;
+atomic<int> ready(0);
+vector<thread> producers;
+for (int p=0; p<PRODUCERS; p++) producers.push_back(thread([&, p](){
+ready++;
+while (ready<PRODUCERS) this_thread::yield();
+for (int i=0; i<ITEMS_PER_PRODUCER; i++) {
+q.push({ p, i });
+if (i%1000==0) this_thread::yield();
+}}));
+// Items of each producer must come out in the order they were pushed, none lost nor duplicated
+vector<int> next(PRODUCERS, 0);
+long long received = 0, total = (long long)PRODUCERS * ITEMS_PER_PRODUCER;
+int maxSize = 0;
+bool ok = true;
+Item it;
+while (received<total) {
+maxSize = max(maxSize, q.size());
+if (!q.pop(it)) { this_thread::yield(); continue; }
+if (it.producer<0 || it.producer>=PRODUCERS || it.seq!=next[it.producer]) {
+printf("round %d: item %d of producer %d received, %d expected\n", round, it.seq, it.producer, it.producer>=0 && it.producer<PRODUCERS? next[it.producer] : -1);
+ok = false;
+break;
+}
+next[it.producer]++;
+received++;
+}
+for (thread& t: producers) t.join();
+if (ok && (q.pop(it) || q.size()!=0)) {
+printf("round %d: queue not empty after all items were received\n", round);
+ok = false;
+}
+printf("round %d: %lld items from %d producers, max size %d: %s\n", round, received, PRODUCERS, maxSize, ok? "ok" : "FAILED");
+return ok;
+}
+
+int main () {
+bool ok = true;
+for (int r=0; r<ROUNDS && ok; r++) ok = RunRound(r);
+return ok? 0 : 1;
+}
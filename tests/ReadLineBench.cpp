@@ -0,0 +1,81 @@
+/* Reads a 100 MB file line by line through the buffered reader of File, compared with reading it one byte at a time from the IO as readUntil used to
+Links against the core DLL, e.g. from this directory: g++ -std=gnu++14 -O2 -fno-rtti ReadLineBench.cpp -o ReadLineBench.exe -I../core -L../link -lqc6pad10 -m32 -mthreads
+Run it with the DLL next to it; the file is created in the current directory and deleted afterwards
+*/
+#include "global.h"
+#include "File.h"
+#include<chrono>
+using namespace std;
+
+#define FILE_SIZE (100*1048576)
+#define UNBUFFERED_SIZE (4*1048576) // Reading byte by byte is too slow for the whole file
+
+static double Seconds (const chrono::steady_clock::time_point& start) {
+return chrono::duration<double>(chrono::steady_clock::now() - start).count();
+}
+
+static bool MakeFile (const tstring& file) {
+File fd(file, true);
+if (!fd) return false;
+string line;
+for (int size=0, i=0; size<FILE_SIZE; i++) {
+line.assign(8 + (i*37)%120, 'a' + i%26);
+line += (i%3? "\r\n" : "\n");
+if (!fd.writeFully(line.data(), line.size())) return false;
+size += line.size();
+}
+return true;
+}
+
+int main () {
+tstring file = TEXT("ReadLineBench.tmp");
+if (!MakeFile(file)) {
+printf("Couldn't create %ls\n", file.c_str());
+return 1;
+}
+long long total = 0, lines = 0;
+// Views into the read buffer, without any copy
+{ auto start = chrono::steady_clock::now();
+File fd(file);
+boost::string_ref line;
+while (fd.readLine(line)) {
+total += line.size();
+lines++;
+}
+double t = Seconds(start);
+printf("readLine (view): %lld lines, %lld bytes in %.3f s, %.1f MB/s\n", lines, total, t, FILE_SIZE/1048576.0/t);
+}
+// A string per line, with CR removed
+{ auto start = chrono::steady_clock::now();
+File fd(file);
+total = lines = 0;
+while (fd) {
+string line = fd.readLine();
+if (!fd && line.empty()) break; // End of file after the last line ending
+total += line.size();
+lines++;
+}
+double t = Seconds(start);
+printf("readUntil (string): %lld lines, %lld bytes in %.3f s, %.1f MB/s\n", lines, total, t, FILE_SIZE/1048576.0/t);
+}
+// The former readUntil: one IO read per byte, on the first megabytes only
+{ auto start = chrono::steady_clock::now();
+IO* io = File::openIO(file);
+total = lines = 0;
+string line;
+char c;
+for (int n=0; n<UNBUFFERED_SIZE && io->Read(&c, 1)==1; n++) {
+if (c=='\r') continue;
+if (c!='\n') { line += c; continue; }
+total += line.size();
+lines++;
+line.clear();
+}
+io->Close();
+delete io;
+double t = Seconds(start);
+printf("Byte by byte, first %d MB: %lld lines, %lld bytes in %.3f s, %.1f MB/s\n", UNBUFFERED_SIZE/1048576, lines, total, t, UNBUFFERED_SIZE/1048576.0/t);
+}
+DeleteFile(file.c_str());
+return 0;
+}
@@ -0,0 +1,116 @@
+/* Stress test of the task scheduler: nested waits on workers, Then chains, cancellation and exceptions thrown by tasks
+Builds and runs on its own, e.g. on Linux: g++ -std=c++14 -O2 -pthread -I../core TaskSchedulerStress.cpp ../core/TaskScheduler.cpp -o TaskSchedulerStress && ./TaskSchedulerStress
+Add -fsanitize=thread to check the memory ordering as well
+*/
+#include "TaskScheduler.h"
+#include<vector>
+#include<cstdio>
+#include<atomic>
+#include<stdexcept>
+#include<thread>
+using namespace std;
+
+#define CHAIN_LENGTH 10000
+#define ROUNDS 5
+
+// Each task waits for the two it submits, so that far more tasks wait than there are workers
+static long long Fib (int n) {
+if (n<2) return n;
+long long a = 0, b = 0;
+Task t = SubmitTask([&](){ a = Fib(n -1); });
+b = Fib(n -2);
+t.Wait();
+return a+b;
+}
+
+static bool TestNestedWaits () {
+long long r = 0;
+SubmitTask([&](){ r = Fib(22); }) .Wait();
+if (r!=17711) { printf("Nested waits: got %lld instead of 17711\n", r); return false; }
+// All workers waiting for tasks still queued behind them
+int n = GetWorkerCount() *4;
+atomic<int> done(0);
+vector<Task> outer;
+for (int i=0; i<n; i++) outer.push_back(SubmitTask([&](){
+Task inner = SubmitTask([&](){ done++; }, TASK_LOW);
+inner.Wait();
+}, TASK_HIGH));
+for (Task& t: outer) t.Wait();
+if (done!=n) { printf("Nested waits: %d inner tasks run instead of %d\n", done.load(), n); return false; }
+return true;
+}
+
+static bool TestThenChains () {
+atomic<int> next(0);
+bool ordered = true;
+Task t = SubmitTask([&](){ next++; });
+for (int i=1; i<CHAIN_LENGTH; i++) t = t.Then([&, i](){
+if (next.load()!=i) ordered = false;
+next++;
+}, i%TASK_PRIORITIES);
+t.Wait();
+if (!ordered || next!=CHAIN_LENGTH) { printf("Then chain: %d continuations run, ordered=%d\n", next.load(), ordered); return false; }
+// Continuations added while the task is finishing
+atomic<int> count(0);
+for (int i=0; i<1000; i++) {
+Task a = SubmitTask([](){});
+Task b = a.Then([&](){ count++; });
+b.Wait();
+}
+if (count!=1000) { printf("Then on finishing tasks: %d run instead of 1000\n", count.load()); return false; }
+return true;
+}
+
+static bool TestCancellation () {
+CancellationToken token;
+atomic<bool> started(false), release(false);
+atomic<int> run(0);
+Task blocker = SubmitTask([&](){
+started = true;
+while (!release) IsCurrentTaskCancelled();
+}, TASK_HIGH, token);
+while (!started) this_thread::yield();
+vector<Task> tasks;
+for (int i=0; i<1000; i++) tasks.push_back(SubmitTask([&](){ run++; }, TASK_LOW, token));
+Task chained = tasks.back().Then([&](){ run++; });
+token.Cancel();
+release = true;
+blocker.Wait();
+if (!blocker.IsDone() || blocker.IsCancelled()) { printf("Cancellation: a running task was reported as cancelled\n"); return false; }
+for (Task& t: tasks) t.Wait();
+chained.Wait();
+int cancelled = 0;
+for (Task& t: tasks) if (t.IsCancelled()) cancelled++;
+if (cancelled+run.load()!=1000 || !chained.IsCancelled()) { printf("Cancellation: %d cancelled, %d run, continuation cancelled=%d\n", cancelled, run.load(), chained.IsCancelled()); return false; }
+// A timed wait gives up without cancelling the task
+atomic<bool> stop(false);
+Task slow = SubmitTask([&](){ while (!stop) {} });
+if (slow.Wait(20)) { printf("Timed wait: returned true for a running task\n"); return false; }
+stop = true;
+slow.Wait();
+return true;
+}
+
+static bool TestExceptions () {
+Task t = SubmitTask([](){ throw runtime_error("expected"); });
+Task after = t.Then([](){});
+after.Wait();
+if (!t.GetException() || after.GetException()) { printf("Exceptions: not recorded on the right task\n"); return false; }
+try {
+rethrow_exception(t.GetException());
+} catch (runtime_error&) {
+return true;
+}
+printf("Exceptions: wrong exception recorded\n");
+return false;
+}
+
+int main () {
+printf("%d workers\n", GetWorkerCount());
+bool ok = true;
+for (int r=0; r<ROUNDS && ok; r++) {
+ok = TestNestedWaits() && TestThenChains() && TestCancellation() && TestExceptions();
+printf("Round %d: %s\n", r+1, ok? "ok" : "failed");
+}
+return ok? 0 : 1;
+}
@@ -0,0 +1,66 @@
+/* Save throughput of TextWriter across all line ending and encoding combinations, compared with converting the whole text in memory first as saving used to do
+Links against the core DLL, e.g. from this directory: g++ -std=gnu++14 -O2 -fno-rtti TextWriterBench.cpp -o TextWriterBench.exe -I../core -L../link -lqc6pad10 -m32 -mthreads
+Run it with the DLL next to it; an optional argument gives the size of the text in megacharacters, 64 by default
+*/
+#include "global.h"
+#include "File.h"
+#include "TextWriter.h"
+#include<chrono>
+#include<cstdlib>
+using namespace std;
+
+static tstring MakeText (int size) {
+tstring text;
+text.reserve(size+128);
+const TCHAR* words[] = { TEXT("lorem"), TEXT("ipsum"), TEXT("d\xE9j\xE0"), TEXT("vu"), TEXT("\x20AC"), TEXT("na\xEFve"), TEXT("\tindented"), TEXT("trailing  ") };
+for (int i=0; text.size()<size; i++) {
+text += words[(i*7)%8];
+text += (i%12==11? TEXT("\r\n") : TEXT(" "));
+}
+text.resize(size);
+return text;
+}
+
+static double Seconds (const chrono::steady_clock::time_point& start) {
+return chrono::duration<double>(chrono::steady_clock::now() - start).count();
+}
+
+// Streamed through TextWriter in chunks of 1M characters, as Page::SaveData does
+static double SaveStreamed (const tstring& file, const tstring& text, int encoding, int lineEnding) {
+auto start = chrono::steady_clock::now();
+File fd(file, true);
+TextWriter writer(fd, encoding, lineEnding);
+for (int pos=0, len=text.size(), chunk=1048576; pos<len; pos+=chunk) writer.write(text.data()+pos, min(chunk, len-pos));
+writer.finish();
+fd.close();
+return Seconds(start);
+}
+
+// Line endings converted on a full copy, then the whole copy encoded and written
+static double SaveWhole (const tstring& file, const tstring& text, int encoding, int lineEnding) {
+auto start = chrono::steady_clock::now();
+static const TCHAR* endings[] = { TEXT("\r\n"), TEXT("\n"), TEXT("\r"), TEXT("\x1E"), TEXT("\x2028") };
+tstring str = lineEnding==LE_DOS? text : replace_all_copy(text, TSTR("\r\n"), tstring(endings[lineEnding]));
+string data = ConvertToEncoding(str, encoding);
+File fd(file, true);
+fd.writeFully(data.data(), data.size());
+fd.close();
+return Seconds(start);
+}
+
+int main (int argc, char** argv) {
+int size = (argc>1? atoi(argv[1]) : 64) * 1048576;
+tstring text = MakeText(size);
+tstring file = TEXT("TextWriterBench.tmp");
+const int encodings[] = { 1252, CP_UTF8, CP_UTF8_BOM, CP_UTF16_LE, CP_UTF16_BE };
+const char* encodingNames[] = { "cp1252", "UTF-8", "UTF-8 BOM", "UTF-16 LE", "UTF-16 BE" };
+const char* lineEndingNames[] = { "CRLF", "LF", "CR", "RS", "LS" };
+printf("%d Mchars\nEncoding\tLine ending\tStreamed (Mchars/s)\tWhole text (Mchars/s)\n", size/1048576);
+for (int e=0; e<5; e++) for (int le=LE_DOS; le<=LE_LS; le++) {
+double streamed = SaveStreamed(file, text, encodings[e], le);
+double whole = SaveWhole(file, text, encodings[e], le);
+printf("%s\t%s\t%.1f\t%.1f\n", encodingNames[e], lineEndingNames[le], size/1048576.0/streamed, size/1048576.0/whole);
+}
+DeleteFile(file.c_str());
+return 0;
+}